@@ -0,0 +1,60 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+const size_t FRAME_ARENA_CAPACITY = 1 << 20;
+
+// Bump allocator for data that lives until the next reset(), which releases
+// everything at once. Allocations that overflow the block are served from
+// extra heap blocks, and the next reset() replaces them with one block large
+// enough for all of them, so a steady workload never touches the heap.
+class LinearArena
+{
+public:
+    LinearArena(size_t capacity);
+    virtual ~LinearArena() = default;
+
+    void* allocate(size_t size, size_t alignment);
+    void reset();
+    size_t get_used() const;
+    size_t get_capacity() const;
+
+    template <typename T>
+    T* allocate(size_t count)
+    {
+        return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+    }
+
+private:
+    std::unique_ptr<char[]> block_;
+    size_t capacity_;
+    size_t used_ = 0;
+    std::vector<std::unique_ptr<char[]>> overflow_blocks_;
+    size_t overflow_used_ = 0;
+};
+
+// The calling thread's frame arena, reset by whoever owns that thread's
+// frame loop.
+LinearArena& get_frame_arena();
+
+// Heap usage of one thread, for checking that hot loops do not allocate and
+// for reporting what an import costs. Only executables that link
+// src/heap_counter.cpp, which replaces the global operator new, count
+// anything; elsewhere is_counting_heap() is false and the counts stay zero.
+struct HeapCounts
+{
+    size_t n_allocations = 0;
+    // Bytes this thread allocated minus the bytes it freed, which can go
+    // negative if it frees memory another thread allocated.
+    ptrdiff_t live_bytes = 0;
+    ptrdiff_t peak_live_bytes = 0;
+};
+
+// The calling thread's counts.
+HeapCounts& get_heap_counts();
+void enable_heap_counting();
+bool is_counting_heap();
+
+// Peak resident set size of the process so far, in bytes.
+size_t get_peak_rss();
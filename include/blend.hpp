@@ -0,0 +1,50 @@
+#pragma once
+#include "model.hpp"
+#include <string>
+
+// Per-bone blend weights in [0, 1], used to restrict a layer to part of the
+// skeleton (e.g. the upper body).
+using BoneMask = std::array<float, MAX_BONES>;
+
+struct BlendLayer
+{
+    Animation* animation = nullptr;
+    float time = 0.f;
+    float weight = 1.f;
+    const BoneMask* mask = nullptr;
+};
+
+// Weighted sum of local poses. Rotations are kept structure-of-arrays so
+// hemisphere correction and normalization run on four bones at a time.
+struct PoseAccumulator
+{
+    alignas(16) float positions[3 * MAX_BONES];
+    alignas(16) float scales[3 * MAX_BONES];
+    alignas(16) float rotations[4][MAX_BONES];
+    alignas(16) float weights[MAX_BONES];
+};
+
+// Sets `mask` to 1 for `root_bone` and all of its descendants and 0 for
+// every other bone.
+bool make_bone_mask(BoneMask& mask, const Model* model, const std::string& root_bone);
+
+void clear_pose_accumulator(PoseAccumulator& acc, size_t n_bones);
+
+// Adds `pose` with `weight` (scaled per bone by `mask` if given). Each
+// rotation is flipped onto the same hemisphere as the running sum first.
+void accumulate_pose(
+    PoseAccumulator& acc,
+    const LocalPose& pose,
+    float weight,
+    const BoneMask* mask,
+    size_t n_bones
+    );
+
+// Divides out the accumulated weights and renormalizes rotations. Bones that
+// received no weight take their transform from `fallback`.
+void resolve_pose(
+    LocalPose& pose,
+    const PoseAccumulator& acc,
+    const LocalPose& fallback,
+    size_t n_bones
+    );
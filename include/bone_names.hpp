@@ -0,0 +1,45 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+const uint8_t INVALID_BONE_ID = UINT8_MAX;
+
+// Bone names interned into one contiguous pool and indexed by a minimal
+// perfect hash that build() computes once per skeleton. A lookup hashes the
+// name once and compares it against a single candidate, so resolving the
+// channels of a clip library against a shared skeleton never allocates.
+class BoneNameTable
+{
+public:
+    void clear();
+    // Interns `name` for `bone_id`. A repeated name resolves to the bone it
+    // was inserted for last.
+    void insert(const char* name, size_t length, uint8_t bone_id);
+    bool build();
+
+    // Returns INVALID_BONE_ID for names not in the table.
+    uint8_t find(const char* name, size_t length) const;
+    // Returns "" for bones without a name.
+    const char* get_name(uint8_t bone_id) const;
+    size_t size() const;
+
+private:
+    struct Entry
+    {
+        uint64_t hash;
+        uint32_t name_offset;
+        uint32_t length;
+        uint8_t bone_id;
+    };
+
+    size_t get_slot(uint64_t hash) const;
+
+    std::vector<char> names_;
+    std::vector<Entry> entries_;
+    std::vector<uint32_t> bone_name_offsets_;
+    // Keys are split into buckets by hash; each bucket's seed scatters its
+    // keys onto otherwise unused slots, and each slot holds one entry index.
+    std::vector<uint16_t> bucket_seeds_;
+    std::vector<uint32_t> slots_;
+};
@@ -0,0 +1,138 @@
+#pragma once
+#include "model.hpp"
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+
+using PaletteHandle = size_t;
+
+struct Instance
+{
+    Model* model;
+    Animation* animation;
+    glm::mat4 transform {1.f};
+    float time_offset = 0.f;
+    // Bones to evaluate, from ModelManager::compute_required_bones. Instances
+    // share cached poses only if their masks are equal.
+    const BoneSet* bone_mask = nullptr;
+
+    size_t lod = 0;
+    bool has_pose = false;
+    size_t pose_lod = 0;
+    PaletteHandle palette_h = 0;
+};
+
+struct PoseCacheStats
+{
+    size_t n_hits = 0;
+    size_t n_misses = 0;
+};
+
+// Shares skinning palettes between instances sampling the same clip of the
+// same model at the same quantized time. Entries stay alive while they are
+// acquired or retained every frame and are recycled otherwise.
+class PoseCache
+{
+public:
+    PoseCache(ModelManager* mm, float time_quantum = 1.f / 60.f);
+    virtual ~PoseCache() = default;
+
+    void set_time_quantum(float time_quantum);
+    void begin_frame();
+    PaletteHandle acquire(
+        Model* model,
+        Animation* animation,
+        float time,
+        size_t lod,
+        const BoneSet* bone_mask = nullptr
+        );
+    void retain(PaletteHandle palette_h);
+    const Pose& get_palette(PaletteHandle palette_h) const;
+    // Bounds of the mesh skinned with the palette, in model space.
+    const BoundingBox& get_bbox(PaletteHandle palette_h) const;
+    const PoseCacheStats& get_stats() const;
+
+private:
+    struct Key
+    {
+        const Model* model;
+        const Animation* animation;
+        int64_t tick;
+        size_t lod;
+        // Masks are keyed by value, so masks edited in place stop matching
+        // their old entries and equal masks share them.
+        bool has_mask;
+        BoneSet mask;
+
+        bool operator==(const Key& that) const
+        {
+            return (
+                model == that.model and
+                animation == that.animation and
+                tick == that.tick and
+                lod == that.lod and
+                has_mask == that.has_mask and
+                mask == that.mask
+                );
+        }
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const;
+    };
+
+    struct Entry
+    {
+        Key key;
+        bool is_free;
+        size_t last_used_frame;
+        Pose palette;
+        BoundingBox bbox;
+    };
+
+    ModelManager* mm_;
+    float time_quantum_;
+    size_t frame_ = 0;
+    std::deque<Entry> entries_;
+    std::vector<PaletteHandle> free_entries_;
+    std::unordered_map<Key, PaletteHandle, KeyHash> lookup_;
+    LocalPose local_pose_;
+    PoseCacheStats stats_;
+};
+
+struct SchedulerStats
+{
+    size_t n_evaluated = 0;
+    size_t n_skipped = 0;
+};
+
+// Updates instance poses at a rate picked from their LOD and visibility:
+// near instances every frame, distant ones every 2nd or 4th frame and
+// off-screen ones every 4th, staggered by instance index so the skipped
+// work is spread evenly across frames. Skipped instances hold their last
+// pose.
+class AnimationScheduler
+{
+public:
+    AnimationScheduler(ModelManager* mm, PoseCache* cache);
+    virtual ~AnimationScheduler() = default;
+
+    void update(
+        std::vector<Instance>& instances,
+        float time,
+        const glm::mat4& projection,
+        const glm::mat4& view
+        );
+    const SchedulerStats& get_stats() const;
+
+private:
+    ModelManager* mm_;
+    PoseCache* cache_;
+    size_t frame_ = 0;
+    SchedulerStats stats_;
+
+    size_t get_update_interval(size_t lod, bool is_visible) const;
+};
@@ -23,6 +23,13 @@ public:
         const glm::mat4& view,
         const std::vector<VertPC>& vertices
         );
+    void draw(
+        GLenum mode,
+        const glm::mat4& projection,
+        const glm::mat4& view,
+        const VertPC* vertices,
+        size_t n_vertices
+        );
 
 private:
     static const size_t BATCH_SIZE = 1000;
@@ -0,0 +1,8 @@
+#pragma once
+
+// The GL scalar types that GL-free code needs to hold handles and draw
+// ranges for the renderer, declared exactly as glad declares them so the two
+// headers can be included together.
+typedef unsigned int GLuint;
+typedef int GLint;
+typedef int GLsizei;
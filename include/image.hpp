@@ -1,4 +1,6 @@
 #pragma once
+#include <cstdint>
+#include <vector>
 #include <glad/glad.h>
 
 class ImageLoader
@@ -9,4 +11,8 @@ public:
 
     bool init();
     GLuint make_texture_from_image(const char* path);
+    // Uploads RGBA8 pixels, bottom row first, as load_image_pixels returns.
+    GLuint make_texture_from_pixels(const std::vector<uint8_t>& pixels, size_t width, size_t height);
+    // Decodes to RGBA8 with the bottom row first, without touching GL.
+    bool load_image_pixels(std::vector<uint8_t>& pixels, size_t& width, size_t& height, const char* path);
 };
@@ -0,0 +1,65 @@
+#pragma once
+#include "mapped_io.hpp"
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+
+class ImporterPool;
+
+// A scene parsed by one of the pool's importers. The importer stays checked
+// out, and the scene alive, until the handle is released or destroyed.
+class SceneHandle
+{
+public:
+    SceneHandle() = default;
+    SceneHandle(const SceneHandle&) = delete;
+    SceneHandle& operator=(const SceneHandle&) = delete;
+    SceneHandle(SceneHandle&& that);
+    SceneHandle& operator=(SceneHandle&& that);
+    virtual ~SceneHandle();
+
+    const aiScene* get_scene() const;
+    // The files the importer opened or probed while parsing the scene.
+    const std::vector<std::string>& get_requested_paths() const;
+    void release();
+
+private:
+    friend class ImporterPool;
+
+    ImporterPool* pool_ = nullptr;
+    size_t importer_id_ = 0;
+    const aiScene* scene_ = nullptr;
+};
+
+// Assimp importers are not safe to share between threads, so concurrent
+// imports each check one out of this pool. read_file blocks while every
+// importer is busy.
+class ImporterPool
+{
+public:
+    ImporterPool(size_t n_importers);
+
+    // Mounts the pack on every importer's file system. Not safe while
+    // imports are in flight.
+    bool mount_pack(const char* path);
+    // Returns an empty handle if the file fails to parse.
+    SceneHandle read_file(const char* path, unsigned int post_process_flags);
+    size_t size() const;
+
+private:
+    friend class SceneHandle;
+
+    void release(size_t importer_id);
+
+    std::vector<std::unique_ptr<Assimp::Importer>> importers_;
+    // Owned by the importer at the same index.
+    std::vector<MappedIOSystem*> io_systems_;
+    std::vector<size_t> free_importers_;
+    std::mutex mutex_;
+    std::condition_variable importer_freed_;
+};
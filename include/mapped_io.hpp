@@ -0,0 +1,71 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <assimp/IOStream.hpp>
+#include <assimp/IOSystem.hpp>
+
+// A read-only memory mapping of a whole file, unmapped on destruction.
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    virtual ~MappedFile();
+
+    bool open(const char* path);
+    const char* get_data() const;
+    size_t get_size() const;
+
+private:
+    void* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Assimp file system that serves reads straight from memory mappings, so
+// source files are never staged through stdio buffers. Files found in a
+// mounted asset pack are read from the pack's mapping; anything else is
+// mapped from disk when opened. Writing is not supported.
+class MappedIOSystem : public Assimp::IOSystem
+{
+public:
+    // Packs mounted later take precedence over earlier ones.
+    bool mount_pack(const char* path);
+
+    bool Exists(const char* path) const override;
+    char getOsSeparator() const override;
+    Assimp::IOStream* Open(const char* path, const char* mode = "rb") override;
+    void Close(Assimp::IOStream* stream) override;
+
+    // Every path opened or probed since the last clear, whether or not it
+    // was found, in first-seen order. An import's source files are the
+    // ones its importer asked for, side files (.mtl, .bin) included.
+    const std::vector<std::string>& get_requested_paths() const;
+    void clear_requested_paths();
+
+private:
+    struct PackFile
+    {
+        const char* path;
+        size_t path_length;
+        const char* data;
+        size_t size;
+    };
+
+    const PackFile* find_pack_file(const char* path) const;
+
+    void add_requested_path(const char* path) const;
+
+    std::vector<std::unique_ptr<MappedFile>> packs_;
+    // Sorted by path, in mount order among equal paths.
+    std::vector<PackFile> pack_files_;
+    // Exists is const in Assimp's interface but logs its probes too.
+    mutable std::vector<std::string> requested_paths_;
+};
+
+// Writes `paths` into an asset pack at `pack_path`. Each file is stored
+// under the path it was given, which is the path load_model is called with.
+bool write_asset_pack(const char* pack_path, const std::vector<std::string>& paths);
@@ -1,22 +1,52 @@
 #pragma once
-#include "draw.hpp"
-#include "image.hpp"
-#include "shader.hpp"
+#include "arena.hpp"
+#include "bone_names.hpp"
+#include "gl_types.hpp"
+#include "importer_pool.hpp"
 #include <cstdint>
 #include <array>
+#include <bitset>
+#include <string>
 #include <vector>
 #include <set>
 #include <unordered_map>
 #include <unordered_set>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
-#include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/quaternion.hpp>
 
 const size_t MAX_MESHES = 20;
 const size_t MAX_BONES = 100;
+const size_t MAX_LODS = 4;
+const float ANIMATION_TICKS_PER_SECOND = 24.f;
+
+// Named trade-offs between import speed and runtime efficiency.
+enum class ImportProfile
+{
+    // Parse and upload as fast as possible: no post-processing beyond
+    // triangulation, no simplified LODs, keys kept as authored.
+    FAST_PREVIEW,
+    // Welded, cache-optimized meshes with the full LOD chain and reduced
+    // animation keys.
+    PRODUCTION,
+    // Production, with meshes merged to cut draw calls per instance.
+    CROWD_LOD,
+};
+
+struct ImportSettings
+{
+    const char* name;
+    unsigned int post_process_flags;
+    // Mesh LODs to build, counting the source mesh, at most MAX_LODS.
+    size_t n_mesh_lods;
+    bool reduce_keys;
+};
+
+const ImportSettings& get_import_settings(ImportProfile profile);
+// Looks a profile up by its name, e.g. "crowd-LOD".
+bool find_import_profile(ImportProfile& profile, const char* name);
 
 struct VertPNUBiBw
 {
@@ -27,15 +57,26 @@ struct VertPNUBiBw
     glm::vec4 bone_weights;
 };
 
-struct Mesh
+struct MeshLod
 {
-    uint8_t material_h;
     GLsizei offset;
     GLsizei count;
 };
 
+using BoneSet = std::bitset<MAX_BONES>;
+using MeshSet = std::bitset<MAX_MESHES>;
+
+struct Mesh
+{
+    uint8_t material_h;
+    size_t n_lods = 0;
+    std::array<MeshLod, MAX_LODS> lods;
+    BoneSet bones;
+};
+
 struct Material
 {
+    std::string diffuse_path;
     GLuint diffuse_tex;
 };
 
@@ -55,18 +96,83 @@ struct BoundingBox
     }
 };
 
+struct BoneBounds
+{
+    glm::vec4 center;
+    glm::vec4 extent;
+
+    bool is_empty() const
+    {
+        return extent.x < 0.f;
+    }
+};
+
 using Pose = std::array<glm::mat4, MAX_BONES>;
 
-struct PosRotScale
+// Non-owning views of a pose's first n_bones transforms, so pose storage can
+// be sized to the skeleton and poses are passed around without copies.
+struct PoseView
 {
-    glm::vec3 position {0.f, 0.f, 0.f};
-    glm::quat rotation;
-    glm::vec3 scale {1.f, 1.f, 1.f};
+    glm::mat4* data;
+    size_t n_bones;
 
-    glm::mat4 to_mat4() const
+    PoseView(glm::mat4* data, size_t n_bones)
+      : data {data}
+      , n_bones {n_bones}
     {
-        glm::mat4 mat = glm::scale(glm::mat4_cast(rotation), scale);
-        mat[3] = glm::vec4{position, 1};
+    }
+
+    PoseView(Pose& pose)
+      : PoseView {pose.data(), pose.size()}
+    {
+    }
+
+    glm::mat4& operator[](size_t i) const
+    {
+        return data[i];
+    }
+};
+
+struct ConstPoseView
+{
+    const glm::mat4* data;
+    size_t n_bones;
+
+    ConstPoseView(const glm::mat4* data, size_t n_bones)
+      : data {data}
+      , n_bones {n_bones}
+    {
+    }
+
+    ConstPoseView(const Pose& pose)
+      : ConstPoseView {pose.data(), pose.size()}
+    {
+    }
+
+    ConstPoseView(const PoseView& view)
+      : ConstPoseView {view.data, view.n_bones}
+    {
+    }
+
+    const glm::mat4& operator[](size_t i) const
+    {
+        return data[i];
+    }
+};
+
+// Local bone transforms kept as separate translation, rotation and scale
+// arrays, the form clips are sampled and blended in. Matrices are only built
+// while composing the global pose.
+struct LocalPose
+{
+    std::array<glm::vec3, MAX_BONES> positions;
+    std::array<glm::quat, MAX_BONES> rotations;
+    std::array<glm::vec3, MAX_BONES> scales;
+
+    glm::mat4 to_mat4(size_t i) const
+    {
+        glm::mat4 mat = glm::scale(glm::mat4_cast(rotations[i]), scales[i]);
+        mat[3] = glm::vec4{positions[i], 1};
         return mat;
     }
 };
@@ -78,16 +184,26 @@ struct Model
     GLuint vbo;
     GLuint ebo;
     std::array<Mesh, MAX_MESHES> meshes;
+    size_t n_materials = 0;
     std::array<Material, MAX_MESHES> materials;
+    std::vector<VertPNUBiBw> vertices;
+    std::vector<GLuint> indices;
     BoundingBox bbox;
+    // Bind-space bounds of the vertices each bone moves, per skeleton LOD.
+    std::array<std::array<BoneBounds, MAX_BONES>, MAX_LODS> bone_bounds;
 
-    std::unordered_map<std::string, uint8_t> bone_mapping;
+    BoneNameTable bone_names;
     size_t n_bones = 0;
     std::array<uint8_t, MAX_BONES> parent_ids;
     std::vector<std::pair<uint8_t, glm::vec3>> bone_ends;
     Pose offsets;
-    Pose default_pose;
-    std::array<PosRotScale, MAX_BONES> default_pose_prs;
+    LocalPose default_pose;
+
+    // Skeleton LOD l evaluates only skeleton_lod_bones[l]; every other bone
+    // follows its nearest evaluated ancestor skeleton_lod_remap[l][bone].
+    size_t n_skeleton_lods = 0;
+    std::array<BoneSet, MAX_LODS> skeleton_lod_bones;
+    std::array<std::array<uint8_t, MAX_BONES>, MAX_LODS> skeleton_lod_remap;
 };
 
 template <typename T>
@@ -99,87 +215,339 @@ struct Key
 
 struct Channel
 {
-    uint8_t bone_id;
+    uint8_t bone_id = 0;
     std::vector<Key<glm::vec3>> position_keys;
     std::vector<Key<glm::quat>> rotation_keys;
+    std::vector<Key<glm::vec3>> scale_keys;
 };
 
+// Additive clips store their keys as deltas from the model's rest pose:
+// positions as offsets, rotations as local rotations applied after the base
+// pose's and scales as factors.
 struct Animation
 {
     float duration;
+    bool is_additive = false;
     size_t n_channels = 0;
     std::array<Channel, MAX_BONES> channels;
 };
 
+// Skinning palettes of a clip sampled at a fixed rate, stored in a float
+// texture with one row per frame and three texels (the upper 3x4 rows) per
+// bone, so instances can be animated entirely on the GPU.
+struct BakedAnimation
+{
+    GLuint palette_tex;
+    size_t n_frames = 0;
+    float duration;
+};
+
+const size_t VAT_TEXTURE_WIDTH = 4096;
+
+// Fully skinned vertices of a clip sampled at a fixed rate. Texel
+// frame * n_vertices + vertex (in rows of VAT_TEXTURE_WIDTH) holds the
+// position quantized to 16-bit unorm within the clip's bounds and the normal
+// quantized to 8-bit snorm, 4 components each.
+struct VertexAnimation
+{
+    size_t n_vertices = 0;
+    size_t n_frames = 0;
+    float duration;
+    BoundingBox bounds;
+    std::vector<uint16_t> positions;
+    std::vector<int8_t> normals;
+    GLuint position_tex = 0u;
+    GLuint normal_tex = 0u;
+};
+
+// A pose whose global transforms and GPU palette are kept up to date
+// incrementally. Bones whose local transform changed are marked dirty, only
+// their subtrees are recomposed and only the palette entries that changed
+// are uploaded to the pose's own uniform buffer.
+struct PoseState
+{
+    LocalPose local_pose;
+    Pose global_pose;
+    Pose palette;
+    BoneSet dirty;
+    BoneSet palette_dirty;
+    // What global_pose was last composed for. The mask is kept by value so
+    // masks edited in place are noticed too.
+    size_t lod = 0;
+    bool has_mask = false;
+    BoneSet mask;
+    GLuint palette_ubo = 0u;
+};
+
+struct BlendLayer;
+class DrawUtil;
+class ImageLoader;
+class ShaderManager;
+class Skinner;
+
 class ModelManager
 {
 public:
     ModelManager(ShaderManager* sm, ImageLoader* il, DrawUtil* du);
     virtual ~ModelManager() = default;
 
-    bool init();
+    // Serves later imports of the files in the pack from its mapping.
+    bool mount_asset_pack(const char* path);
     bool analyze_model(const char* path);
-    bool load_model(Model* model, Animation* animation, const char* path);
-    void update_pose(Model* model, Pose& pose, Animation* animation, float time);
+    // How many imports can run at once; more block until one finishes.
+    size_t get_max_concurrent_imports() const;
+    // The CPU half of load_model. It touches no GL state and no shared
+    // importer, so any number of threads can import at once, up to the
+    // size of the importer pool. The vertex passes use up to max_threads
+    // threads, which callers that already import in parallel should limit.
+    // If source_paths is given, it receives every file the importer opened
+    // or looked for, found or not.
+    bool import_model(
+        Model* model,
+        Animation* animation,
+        const char* path,
+        ImportProfile profile = ImportProfile::PRODUCTION,
+        size_t max_threads = SIZE_MAX,
+        std::vector<std::string>* source_paths = nullptr
+        );
+    // Imports models[i] from paths[i] on worker threads. If is_imported is
+    // given, is_imported[i] records whether models[i] imported.
+    bool import_models(
+        Model* const* models,
+        Animation* const* animations,
+        const char* const* paths,
+        size_t n_models,
+        ImportProfile profile = ImportProfile::PRODUCTION,
+        bool* is_imported = nullptr
+        );
+    // Only the flattening pass of an import: the bone table, names, parents
+    // and rest pose, without logging or skeleton LODs.
+    bool build_skeleton(Model* model, const aiScene* scene);
+    void compute_required_bones(
+        BoneSet& required,
+        const Model* model,
+        const MeshSet& visible_meshes,
+        const uint8_t* query_bones = nullptr,
+        size_t n_query_bones = 0
+        );
+    void update_pose(
+        Model* model,
+        LocalPose& pose,
+        Animation* animation,
+        float time,
+        size_t lod = 0,
+        const BoneSet* bone_mask = nullptr
+        );
+    void blend_pose(
+        Model* model,
+        LocalPose& pose,
+        const BlendLayer* layers,
+        size_t n_layers,
+        size_t lod = 0
+        );
+    bool make_additive(Animation* animation, const Model* model);
+    void apply_additive(
+        Model* model,
+        LocalPose& pose,
+        Animation* animation,
+        float time,
+        float weight,
+        size_t lod = 0
+        );
+    void convert_local_to_global_pose(
+        PoseView global_pose,
+        const Model* model,
+        const LocalPose& local_pose,
+        bool apply_offsets,
+        size_t lod = 0,
+        const BoneSet* bone_mask = nullptr
+        );
+    void set_local_pose(PoseState* state, const Model* model, const LocalPose& local_pose);
+    // Recomposes the dirty subtrees at the given skeleton LOD and mask.
+    // Changing either recomposes the whole pose.
+    void update_global_pose(
+        PoseState* state,
+        const Model* model,
+        size_t lod = 0,
+        const BoneSet* bone_mask = nullptr
+        );
+    // Conservative bounds of the mesh skinned with the given palette.
+    void compute_pose_bbox(BoundingBox& bbox, const Model* model, ConstPoseView palette, size_t lod = 0);
+    size_t select_lod(const Model* model, const glm::mat4& projection, const glm::mat4& view);
+    void bake_vertex_animation(
+        VertexAnimation* vat,
+        Skinner* skinner,
+        Model* model,
+        Animation* animation,
+        float frame_rate
+        );
+
+    // Defined in model_render.cpp. These need the GL context current.
+    bool init();
+    bool load_model(
+        Model* model,
+        Animation* animation,
+        const char* path,
+        ImportProfile profile = ImportProfile::PRODUCTION
+        );
+    // The GL half of load_model: textures and vertex buffers, on the thread
+    // that owns the context.
+    void upload_model(Model* model);
+    // Loads what tools/convert_assets wrote for a model, given its output
+    // path without extension: the .model, the .clip if there is one and the
+    // .tex files its materials name. Nothing is imported.
+    bool load_cached_model(Model* model, Animation* animation, const char* cache_path);
+    void init_pose_state(PoseState* state, const Model* model);
     void draw_model(
         Model* model,
-        const Pose& pose,
+        const LocalPose& pose,
         const glm::mat4& projection,
-        const glm::mat4& view
+        const glm::mat4& view,
+        size_t lod = 0
+        );
+    void draw_model_palette(
+        Model* model,
+        ConstPoseView palette,
+        const glm::mat4& projection,
+        const glm::mat4& view,
+        size_t lod = 0
+        );
+    void draw_model_state(
+        Model* model,
+        PoseState* state,
+        const glm::mat4& projection,
+        const glm::mat4& view,
+        size_t lod = 0
+        );
+    bool bake_animation(BakedAnimation* baked, Model* model, Animation* animation, float frame_rate);
+    void draw_model_baked(
+        Model* model,
+        const BakedAnimation* baked,
+        float time,
+        const glm::mat4& projection,
+        const glm::mat4& view,
+        size_t lod = 0
+        );
+    void upload_vertex_animation(VertexAnimation* vat);
+    void draw_model_vat(
+        Model* model,
+        const VertexAnimation* vat,
+        float time,
+        const glm::mat4& projection,
+        const glm::mat4& view,
+        size_t lod = 0
         );
     void draw_skeleton(
         Model* model,
-        const Pose& pose,
+        const LocalPose& pose,
         const glm::mat4& projection,
-        const glm::mat4& view
+        const glm::mat4& view,
+        size_t lod = 0
         );
 
 private:
     ShaderManager* sm_;
     ImageLoader* il_;
     DrawUtil* du_;
-    Assimp::Importer importer_;
+    ImporterPool importers_;
 
     GLuint program_;
     GLint loc_projection_;
     GLint loc_view_;
-    GLint loc_pose_;
     GLint loc_diffuse_tex_;
+    // draw_model_palette's palettes, one Palette block sized slot per draw.
+    GLuint palette_ring_;
+    size_t palette_slot_size_;
+    size_t palette_ring_offset_;
+
+    GLuint baked_program_;
+    GLint loc_baked_projection_;
+    GLint loc_baked_view_;
+    GLint loc_baked_palette_tex_;
+    GLint loc_baked_n_frames_;
+    GLint loc_baked_frame_;
+    GLint loc_baked_diffuse_tex_;
+
+    GLuint vat_program_;
+    GLint loc_vat_projection_;
+    GLint loc_vat_view_;
+    GLint loc_vat_position_tex_;
+    GLint loc_vat_normal_tex_;
+    GLint loc_vat_n_vertices_;
+    GLint loc_vat_n_frames_;
+    GLint loc_vat_frame_;
+    GLint loc_vat_bounds_min_;
+    GLint loc_vat_bounds_size_;
+    GLint loc_vat_diffuse_tex_;
 
     std::vector<glm::vec3> bone_colors_;
 
-    struct BoneInfo
+    // Exact sizes of the import buffers, counted in one pass over the scene
+    // before anything is allocated.
+    struct SceneSizes
     {
-        int depth;
+        size_t n_nodes = 0;
+        size_t n_vertices = 0;
+        size_t n_indices = 0;
+        size_t n_bone_refs = 0;
+    };
+
+    struct NodeTransform
+    {
+        glm::mat4 transform;
         aiNode* node;
+    };
+
+    struct BoneOffset
+    {
+        const char* name;
         glm::mat4 offset;
+    };
 
-        bool operator<(const BoneInfo& that) const {
-            if (this->depth != that.depth) {
-                return this->depth < that.depth;
-            }
-            return this->node < that.node;
-        }
+    // A node of the scene in breadth-first order, so parents come before
+    // their children and nodes of one depth are contiguous.
+    struct SceneNode
+    {
+        aiNode* node;
+        uint32_t parent;
+        glm::mat4 transform;
+        const BoneOffset* bone_offset;
+        bool is_included;
+        uint8_t bone_id;
     };
 
-    bool gather_bones(
-        std::set<BoneInfo>& included_bones,
-        std::vector<aiNode*>& ai_bone_ends,
-        aiNode* node,
-        bool is_parent_bone,
-        int depth,
-        const glm::mat4& transform,
-        const std::unordered_map<std::string, glm::mat4>& bone_offsets
+    void measure_scene(SceneSizes& sizes, const aiScene* scene, const aiNode* node);
+    bool process_bones(
+        Model* model,
+        const aiScene* scene,
+        const SceneSizes& sizes,
+        LinearArena& arena
         );
-    void process_bones(Model* model, const aiScene* scene);
+    void process_skeleton_lods(Model* model);
     void process_mesh(
         Mesh* mesh,
         std::vector<VertPNUBiBw>& vertices,
         std::vector<GLuint>& indices,
         const glm::mat4& transform,
-        const std::unordered_map<std::string, uint8_t>& bone_mapping,
+        const BoneNameTable& bone_names,
         aiMesh* ai_mesh
         );
+    void process_lods(Model* model, size_t n_lods);
+    void process_bounds(Model* model, const std::vector<VertPNUBiBw>& vertices, size_t max_threads);
+    void process_animation(
+        Animation* animation,
+        const Model* model,
+        const aiAnimation* ai_animation,
+        bool reduce_keys
+        );
     void process_material(Material* mat, aiMaterial* ai_mat, const std::string& base_dir);
-    void convert_local_to_global_pose(Pose& global_pose, const Model* model, const Pose& local_pose, bool apply_offsets);
+    void upload_buffers(Model* model);
+    void draw_palette_buffer(
+        Model* model,
+        GLuint palette_ubo,
+        size_t palette_offset,
+        const glm::mat4& projection,
+        const glm::mat4& view,
+        size_t lod
+        );
 };
@@ -0,0 +1,17 @@
+#pragma once
+#include "model.hpp"
+#include <cstdint>
+#include <vector>
+
+// Reads and writes imported models, clips and decoded textures, so that
+// tools/convert_assets can do the import once and loading becomes a copy.
+// Each file is a small header followed by the raw arrays. Materials keep
+// whatever diffuse_path the model had when it was written.
+bool write_model_cache(const Model* model, const char* path);
+bool read_model_cache(Model* model, const char* path);
+bool write_animation_cache(const Animation* animation, const char* path);
+bool read_animation_cache(Animation* animation, const char* path);
+// RGBA8 pixels, bottom row first, as ImageLoader::load_image_pixels returns
+// them.
+bool write_texture_cache(const std::vector<uint8_t>& pixels, size_t width, size_t height, const char* path);
+bool read_texture_cache(std::vector<uint8_t>& pixels, size_t& width, size_t& height, const char* path);
@@ -0,0 +1,65 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+inline size_t parallel_range_count(size_t count, size_t min_range, size_t max_threads = SIZE_MAX)
+{
+    size_t n_threads = std::max<size_t>(1, std::min<size_t>(max_threads, std::thread::hardware_concurrency()));
+    size_t n_ranges = (count + min_range - 1) / min_range;
+    return std::max<size_t>(1, std::min(n_threads, n_ranges));
+}
+
+// Splits [0, count) into parallel_range_count(count, min_range, max_threads)
+// contiguous ranges and calls fn(range_id, begin, end) for each of them,
+// running all but the first on worker threads.
+template <typename Fn>
+void parallel_for_ranges(size_t count, size_t min_range, size_t max_threads, Fn fn)
+{
+    size_t n_ranges = parallel_range_count(count, min_range, max_threads);
+    size_t range_size = (count + n_ranges - 1) / n_ranges;
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < n_ranges; i++) {
+        size_t begin = std::min(count, i * range_size);
+        size_t end = std::min(count, begin + range_size);
+        workers.emplace_back(fn, i, begin, end);
+    }
+    fn(size_t{0}, size_t{0}, std::min(count, range_size));
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+template <typename Fn>
+void parallel_for_ranges(size_t count, size_t min_range, Fn fn)
+{
+    parallel_for_ranges(count, min_range, SIZE_MAX, fn);
+}
+
+// Hands the indices [0, count) out one at a time to up to max_threads
+// threads, for items of uneven cost, and calls fn(i, max_inner_threads) for
+// each. max_inner_threads splits the hardware threads between the workers,
+// for items that fan out themselves. Returns the number of workers.
+template <typename Fn>
+size_t parallel_for_each(size_t count, size_t max_threads, Fn fn)
+{
+    size_t n_workers = std::max<size_t>(1, std::min(count, max_threads));
+    size_t max_inner_threads = std::max<size_t>(1, std::thread::hardware_concurrency() / n_workers);
+    std::atomic<size_t> next_index {0};
+    auto run_next = [&]() {
+        for (size_t i = next_index++; i < count; i = next_index++) {
+            fn(i, max_inner_threads);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < n_workers; i++) {
+        workers.emplace_back(run_next);
+    }
+    run_next();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    return n_workers;
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include "model.hpp"
+#include <vector>
+
+// Simplifies the triangle list `indices` (into `vertices`) down to at most
+// `target_triangles` triangles using quadric error metrics, collapsing
+// vertices onto existing neighbours so the result shares the same vertex
+// buffer. Vertices on UV/normal seams and open borders are kept in place,
+// collapses that flip faces are rejected and collapses across bone weight
+// boundaries are penalized. Returns the number of triangles written to
+// `lod_indices`.
+size_t simplify_indices(
+    std::vector<GLuint>& lod_indices,
+    const std::vector<VertPNUBiBw>& vertices,
+    const std::vector<GLuint>& indices,
+    size_t target_triangles
+    );
@@ -0,0 +1,77 @@
+#pragma once
+#include "model.hpp"
+#include <array>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Structure-of-arrays copy of a model's vertex stream, padded to a multiple
+// of SKINNING_BLOCK_SIZE with zero-weight vertices so kernels have no tails.
+struct SkinningStream
+{
+    size_t n_vertices = 0;
+    size_t n_padded = 0;
+    std::vector<float> position_x;
+    std::vector<float> position_y;
+    std::vector<float> position_z;
+    std::vector<float> normal_x;
+    std::vector<float> normal_y;
+    std::vector<float> normal_z;
+    std::array<std::vector<int32_t>, 4> bone_ids;
+    std::array<std::vector<float>, 4> bone_weights;
+};
+
+struct SkinnedVertices
+{
+    size_t n_vertices = 0;
+    std::vector<float> position_x;
+    std::vector<float> position_y;
+    std::vector<float> position_z;
+    std::vector<float> normal_x;
+    std::vector<float> normal_y;
+    std::vector<float> normal_z;
+
+    glm::vec3 position(size_t i) const
+    {
+        return glm::vec3{position_x[i], position_y[i], position_z[i]};
+    }
+
+    glm::vec3 normal(size_t i) const
+    {
+        return glm::vec3{normal_x[i], normal_y[i], normal_z[i]};
+    }
+};
+
+struct SkinningStats
+{
+    const char* kernel = "";
+    size_t n_vertices = 0;
+    size_t n_threads = 0;
+    double seconds = 0.0;
+};
+
+const size_t SKINNING_BLOCK_SIZE = 8;
+
+class Skinner
+{
+public:
+    Skinner() = default;
+    virtual ~Skinner() = default;
+
+    bool init();
+    void make_stream(SkinningStream& stream, const Model* model);
+    void skin(SkinnedVertices& skinned, const SkinningStream& stream, ConstPoseView palette);
+    const SkinningStats& get_stats() const;
+    void print_stats() const;
+
+private:
+    enum class Kernel
+    {
+        SCALAR,
+        SSE2,
+        AVX2,
+    };
+
+    Kernel kernel_ = Kernel::SCALAR;
+    SkinningStats stats_;
+};
@@ -0,0 +1,7 @@
+#pragma once
+#include "model.hpp"
+
+// Reads and writes baked vertex animations. The file is a small header
+// followed by the quantized position and normal streams.
+bool write_vertex_animation(const VertexAnimation* vat, const char* path);
+bool read_vertex_animation(VertexAnimation* vat, const char* path);
@@ -11,7 +11,10 @@ layout(location = 4) in vec4 bone_weights;
 uniform mat4 projection;
 uniform mat4 view;
 
-uniform mat4 pose [MAX_BONES];
+layout(std140) uniform Palette
+{
+    mat4 pose [MAX_BONES];
+};
 
 out FS_IN
 {
@@ -0,0 +1,56 @@
+#version 330 core
+
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec3 normal;
+layout(location = 2) in vec2 tex_coord;
+layout(location = 3) in ivec4 bone_ids;
+layout(location = 4) in vec4 bone_weights;
+
+uniform mat4 projection;
+uniform mat4 view;
+
+// Row r of bone b's palette matrix at frame f is texel (3 * b + r, f).
+uniform sampler2D palette_tex;
+uniform int n_frames;
+uniform float frame;
+
+out FS_IN
+{
+    smooth vec3 position;
+    smooth vec3 normal;
+    smooth vec2 tex_coord;
+} vs_out;
+
+mat4 fetch_bone(int bone_id, int frame_id)
+{
+    vec4 row0 = texelFetch(palette_tex, ivec2(3 * bone_id + 0, frame_id), 0);
+    vec4 row1 = texelFetch(palette_tex, ivec2(3 * bone_id + 1, frame_id), 0);
+    vec4 row2 = texelFetch(palette_tex, ivec2(3 * bone_id + 2, frame_id), 0);
+    return transpose(mat4(row0, row1, row2, vec4(0, 0, 0, 1)));
+}
+
+mat4 get_bone(int bone_id)
+{
+    // Rounding can put frame at exactly n_frames, which wraps to frame 0.
+    float frame_floor = floor(frame);
+    int frame0 = int(frame_floor) % n_frames;
+    int frame1 = (frame0 + 1) % n_frames;
+    float interp = frame - frame_floor;
+    return mix(fetch_bone(bone_id, frame0), fetch_bone(bone_id, frame1), interp);
+}
+
+void main()
+{
+    mat4 model = (
+        bone_weights[0] * get_bone(bone_ids[0]) +
+        bone_weights[1] * get_bone(bone_ids[1]) +
+        bone_weights[2] * get_bone(bone_ids[2]) +
+        bone_weights[3] * get_bone(bone_ids[3])
+        );
+    mat4 model_view = view * model;
+    mat4 it_model_view = transpose(inverse(view * model));
+    vs_out.position = vec3(model_view * vec4(position, 1));
+    vs_out.normal   = normalize(vec3(it_model_view * vec4(normal, 0)));
+    vs_out.tex_coord = tex_coord;
+    gl_Position = projection * vec4(vs_out.position, 1);
+}
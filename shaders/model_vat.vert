@@ -0,0 +1,56 @@
+#version 330 core
+
+const int VAT_TEXTURE_WIDTH = 4096;
+
+layout(location = 2) in vec2 tex_coord;
+
+uniform mat4 projection;
+uniform mat4 view;
+
+// Skinned vertex v at frame f is texel f * n_vertices + v, in rows of
+// VAT_TEXTURE_WIDTH. Positions are unorm within the clip bounds.
+uniform sampler2D position_tex;
+uniform sampler2D normal_tex;
+uniform int n_vertices;
+uniform int n_frames;
+uniform float frame;
+uniform vec3 bounds_min;
+uniform vec3 bounds_size;
+
+out FS_IN
+{
+    smooth vec3 position;
+    smooth vec3 normal;
+    smooth vec2 tex_coord;
+} vs_out;
+
+ivec2 get_texel(int frame_id)
+{
+    int index = frame_id * n_vertices + gl_VertexID;
+    return ivec2(index % VAT_TEXTURE_WIDTH, index / VAT_TEXTURE_WIDTH);
+}
+
+void main()
+{
+    // Rounding can put frame at exactly n_frames, which wraps to frame 0.
+    float frame_floor = floor(frame);
+    int frame0 = int(frame_floor) % n_frames;
+    int frame1 = (frame0 + 1) % n_frames;
+    float interp = frame - frame_floor;
+    ivec2 texel0 = get_texel(frame0);
+    ivec2 texel1 = get_texel(frame1);
+    vec3 position = bounds_min + bounds_size * mix(
+        texelFetch(position_tex, texel0, 0).xyz,
+        texelFetch(position_tex, texel1, 0).xyz,
+        interp
+        );
+    vec3 normal = mix(
+        texelFetch(normal_tex, texel0, 0).xyz,
+        texelFetch(normal_tex, texel1, 0).xyz,
+        interp
+        );
+    vs_out.position = vec3(view * vec4(position, 1));
+    vs_out.normal   = normalize(vec3(transpose(inverse(view)) * vec4(normal, 0)));
+    vs_out.tex_coord = tex_coord;
+    gl_Position = projection * vec4(vs_out.position, 1);
+}
@@ -0,0 +1,88 @@
+#include "arena.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <sys/resource.h>
+
+static std::atomic<bool> is_heap_counted {false};
+
+HeapCounts& get_heap_counts()
+{
+    // Constant-initialized, so operator new can use it on any thread at any
+    // time, including while the thread is starting up.
+    thread_local HeapCounts counts;
+    return counts;
+}
+
+void enable_heap_counting()
+{
+    is_heap_counted.store(true, std::memory_order_relaxed);
+}
+
+bool is_counting_heap()
+{
+    return is_heap_counted.load(std::memory_order_relaxed);
+}
+
+size_t get_peak_rss()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    // Linux reports kilobytes.
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+}
+
+static size_t align_up(size_t offset, size_t alignment)
+{
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+LinearArena::LinearArena(size_t capacity)
+  : block_ {new char[capacity]}
+  , capacity_ {capacity}
+{
+}
+
+void* LinearArena::allocate(size_t size, size_t alignment)
+{
+    // new[] returns blocks aligned for any fundamental type, so aligning the
+    // offset aligns the pointer.
+    size_t offset = align_up(used_, alignment);
+    if (offset + size <= capacity_) {
+        used_ = offset + size;
+        return block_.get() + offset;
+    }
+    overflow_blocks_.emplace_back(new char[size + alignment]);
+    overflow_used_ += size + alignment;
+    uintptr_t address = reinterpret_cast<uintptr_t>(overflow_blocks_.back().get());
+    return reinterpret_cast<void*>(align_up(address, alignment));
+}
+
+void LinearArena::reset()
+{
+    if (not overflow_blocks_.empty()) {
+        capacity_ = std::max(2 * capacity_, used_ + overflow_used_);
+        block_.reset(new char[capacity_]);
+        overflow_blocks_.clear();
+        overflow_used_ = 0;
+    }
+    used_ = 0;
+}
+
+size_t LinearArena::get_used() const
+{
+    return used_ + overflow_used_;
+}
+
+size_t LinearArena::get_capacity() const
+{
+    return capacity_;
+}
+
+LinearArena& get_frame_arena()
+{
+    thread_local LinearArena arena {FRAME_ARENA_CAPACITY};
+    return arena;
+}
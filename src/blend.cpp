@@ -0,0 +1,232 @@
+#include "blend.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <glm/gtc/quaternion.hpp>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Bones are processed in blocks of four; MAX_BONES is a multiple of four so
+// the padded count never runs past the pose arrays.
+static size_t padded_bone_count(size_t n_bones)
+{
+    return (n_bones + 3) / 4 * 4;
+}
+
+bool make_bone_mask(BoneMask& mask, const Model* model, const std::string& root_bone)
+{
+    uint8_t root_id = model->bone_names.find(root_bone.c_str(), root_bone.size());
+    if (root_id == INVALID_BONE_ID) {
+        fprintf(stderr, "Failed to find bone %s for mask\n", root_bone.c_str());
+        return false;
+    }
+    mask.fill(0.f);
+    mask[root_id] = 1.f;
+    for (size_t i = root_id + 1; i < model->n_bones; i++) {
+        uint8_t parent_id = model->parent_ids[i];
+        if (parent_id < model->n_bones and mask[parent_id] > 0.f) {
+            mask[i] = 1.f;
+        }
+    }
+    return true;
+}
+
+void clear_pose_accumulator(PoseAccumulator& acc, size_t n_bones)
+{
+    size_t n_padded = padded_bone_count(n_bones);
+    std::fill_n(acc.positions, 3 * n_padded, 0.f);
+    std::fill_n(acc.scales, 3 * n_padded, 0.f);
+    for (size_t k = 0; k < 4; k++) {
+        std::fill_n(acc.rotations[k], n_padded, 0.f);
+    }
+    std::fill_n(acc.weights, n_padded, 0.f);
+}
+
+#if defined(__SSE2__)
+
+// Expands per-bone weights [w0 w1 w2 w3] to match four packed vec3s.
+static inline void expand_vec3_weights(__m128 w, __m128 out[3])
+{
+    out[0] = _mm_shuffle_ps(w, w, _MM_SHUFFLE(1, 0, 0, 0));
+    out[1] = _mm_shuffle_ps(w, w, _MM_SHUFFLE(2, 2, 1, 1));
+    out[2] = _mm_shuffle_ps(w, w, _MM_SHUFFLE(3, 3, 3, 2));
+}
+
+void accumulate_pose(
+        PoseAccumulator& acc,
+        const LocalPose& pose,
+        float weight,
+        const BoneMask* mask,
+        size_t n_bones
+        )
+{
+    const float* positions = &pose.positions[0].x;
+    const float* scales = &pose.scales[0].x;
+    const float* rotations = &pose.rotations[0].x;
+    const __m128 layer_weight = _mm_set1_ps(weight);
+    const __m128 sign_bit = _mm_set1_ps(-0.f);
+    const __m128 zero = _mm_setzero_ps();
+    for (size_t i = 0; i < padded_bone_count(n_bones); i += 4) {
+        __m128 w = mask ? _mm_mul_ps(layer_weight, _mm_loadu_ps(&(*mask)[i])) : layer_weight;
+        _mm_store_ps(&acc.weights[i], _mm_add_ps(_mm_load_ps(&acc.weights[i]), w));
+
+        __m128 w3[3];
+        expand_vec3_weights(w, w3);
+        for (size_t k = 0; k < 3; k++) {
+            size_t offset = 3 * i + 4 * k;
+            __m128 p = _mm_loadu_ps(&positions[offset]);
+            __m128 s = _mm_loadu_ps(&scales[offset]);
+            _mm_store_ps(&acc.positions[offset], _mm_add_ps(_mm_load_ps(&acc.positions[offset]), _mm_mul_ps(p, w3[k])));
+            _mm_store_ps(&acc.scales[offset], _mm_add_ps(_mm_load_ps(&acc.scales[offset]), _mm_mul_ps(s, w3[k])));
+        }
+
+        // Transpose four xyzw quaternions into x, y, z and w lanes.
+        __m128 q[4] = {
+            _mm_loadu_ps(&rotations[4 * i]),
+            _mm_loadu_ps(&rotations[4 * i + 4]),
+            _mm_loadu_ps(&rotations[4 * i + 8]),
+            _mm_loadu_ps(&rotations[4 * i + 12]),
+        };
+        _MM_TRANSPOSE4_PS(q[0], q[1], q[2], q[3]);
+        __m128 sum[4];
+        __m128 dot = zero;
+        for (size_t k = 0; k < 4; k++) {
+            sum[k] = _mm_load_ps(&acc.rotations[k][i]);
+            dot = _mm_add_ps(dot, _mm_mul_ps(sum[k], q[k]));
+        }
+        // q and -q are the same rotation; flip onto the running sum's side.
+        __m128 signed_w = _mm_xor_ps(w, _mm_and_ps(_mm_cmplt_ps(dot, zero), sign_bit));
+        for (size_t k = 0; k < 4; k++) {
+            _mm_store_ps(&acc.rotations[k][i], _mm_add_ps(sum[k], _mm_mul_ps(q[k], signed_w)));
+        }
+    }
+}
+
+void resolve_pose(
+        LocalPose& pose,
+        const PoseAccumulator& acc,
+        const LocalPose& fallback,
+        size_t n_bones
+        )
+{
+    float* positions = &pose.positions[0].x;
+    float* scales = &pose.scales[0].x;
+    float* rotations = &pose.rotations[0].x;
+    const float* fallback_positions = &fallback.positions[0].x;
+    const float* fallback_scales = &fallback.scales[0].x;
+    const float* fallback_rotations = &fallback.rotations[0].x;
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.f);
+    for (size_t i = 0; i < padded_bone_count(n_bones); i += 4) {
+        __m128 w = _mm_load_ps(&acc.weights[i]);
+        __m128 has_weight = _mm_cmpgt_ps(w, zero);
+        __m128 inv_w = _mm_and_ps(has_weight, _mm_div_ps(one, _mm_max_ps(w, _mm_set1_ps(1e-20f))));
+
+        __m128 inv_w3[3], has_weight3[3];
+        expand_vec3_weights(inv_w, inv_w3);
+        expand_vec3_weights(has_weight, has_weight3);
+        for (size_t k = 0; k < 3; k++) {
+            size_t offset = 3 * i + 4 * k;
+            __m128 p = _mm_mul_ps(_mm_load_ps(&acc.positions[offset]), inv_w3[k]);
+            __m128 s = _mm_mul_ps(_mm_load_ps(&acc.scales[offset]), inv_w3[k]);
+            __m128 fallback_p = _mm_loadu_ps(&fallback_positions[offset]);
+            __m128 fallback_s = _mm_loadu_ps(&fallback_scales[offset]);
+            _mm_storeu_ps(&positions[offset], _mm_or_ps(
+                _mm_and_ps(has_weight3[k], p),
+                _mm_andnot_ps(has_weight3[k], fallback_p)
+                ));
+            _mm_storeu_ps(&scales[offset], _mm_or_ps(
+                _mm_and_ps(has_weight3[k], s),
+                _mm_andnot_ps(has_weight3[k], fallback_s)
+                ));
+        }
+
+        __m128 q[4];
+        __m128 length_sq = zero;
+        for (size_t k = 0; k < 4; k++) {
+            q[k] = _mm_load_ps(&acc.rotations[k][i]);
+            length_sq = _mm_add_ps(length_sq, _mm_mul_ps(q[k], q[k]));
+        }
+        // Opposing rotations can cancel out; treat those bones as unweighted.
+        __m128 valid = _mm_cmpgt_ps(length_sq, _mm_set1_ps(1e-12f));
+        __m128 inv_length = _mm_div_ps(one, _mm_sqrt_ps(_mm_max_ps(length_sq, _mm_set1_ps(1e-12f))));
+        for (size_t k = 0; k < 4; k++) {
+            q[k] = _mm_mul_ps(q[k], inv_length);
+        }
+        _MM_TRANSPOSE4_PS(q[0], q[1], q[2], q[3]);
+        __m128 bone_valid[4] = {
+            _mm_shuffle_ps(valid, valid, _MM_SHUFFLE(0, 0, 0, 0)),
+            _mm_shuffle_ps(valid, valid, _MM_SHUFFLE(1, 1, 1, 1)),
+            _mm_shuffle_ps(valid, valid, _MM_SHUFFLE(2, 2, 2, 2)),
+            _mm_shuffle_ps(valid, valid, _MM_SHUFFLE(3, 3, 3, 3)),
+        };
+        for (size_t k = 0; k < 4; k++) {
+            __m128 fallback_q = _mm_loadu_ps(&fallback_rotations[4 * (i + k)]);
+            _mm_storeu_ps(&rotations[4 * (i + k)], _mm_or_ps(
+                _mm_and_ps(bone_valid[k], q[k]),
+                _mm_andnot_ps(bone_valid[k], fallback_q)
+                ));
+        }
+    }
+}
+
+#else
+
+void accumulate_pose(
+        PoseAccumulator& acc,
+        const LocalPose& pose,
+        float weight,
+        const BoneMask* mask,
+        size_t n_bones
+        )
+{
+    for (size_t i = 0; i < n_bones; i++) {
+        float w = mask ? weight * (*mask)[i] : weight;
+        acc.weights[i] += w;
+        for (size_t k = 0; k < 3; k++) {
+            acc.positions[3 * i + k] += w * pose.positions[i][k];
+            acc.scales[3 * i + k] += w * pose.scales[i][k];
+        }
+        const glm::quat& q = pose.rotations[i];
+        float dot = (
+            acc.rotations[0][i] * q.x + acc.rotations[1][i] * q.y +
+            acc.rotations[2][i] * q.z + acc.rotations[3][i] * q.w
+            );
+        float signed_w = dot < 0.f ? -w : w;
+        acc.rotations[0][i] += signed_w * q.x;
+        acc.rotations[1][i] += signed_w * q.y;
+        acc.rotations[2][i] += signed_w * q.z;
+        acc.rotations[3][i] += signed_w * q.w;
+    }
+}
+
+void resolve_pose(
+        LocalPose& pose,
+        const PoseAccumulator& acc,
+        const LocalPose& fallback,
+        size_t n_bones
+        )
+{
+    for (size_t i = 0; i < n_bones; i++) {
+        float w = acc.weights[i];
+        if (w > 0.f) {
+            for (size_t k = 0; k < 3; k++) {
+                pose.positions[i][k] = acc.positions[3 * i + k] / w;
+                pose.scales[i][k] = acc.scales[3 * i + k] / w;
+            }
+        } else {
+            pose.positions[i] = fallback.positions[i];
+            pose.scales[i] = fallback.scales[i];
+        }
+        glm::quat q {acc.rotations[3][i], acc.rotations[0][i], acc.rotations[1][i], acc.rotations[2][i]};
+        float length_sq = q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w;
+        if (length_sq > 1e-12f) {
+            pose.rotations[i] = q * (1.f / std::sqrt(length_sq));
+        } else {
+            pose.rotations[i] = fallback.rotations[i];
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,175 @@
+#include "bone_names.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+static uint64_t hash_name(const char* name, size_t length)
+{
+    // 64-bit FNV-1a.
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ static_cast<unsigned char>(name[i])) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// splitmix64 finalizer.
+static uint64_t mix(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+static uint64_t mix_seed(uint64_t hash, uint64_t seed)
+{
+    // Every seed gives an independent slot.
+    return mix(hash + (seed + 1) * 0x9e3779b97f4a7c15ull);
+}
+
+static size_t get_bucket(uint64_t hash, size_t n_buckets)
+{
+    // FNV-1a barely mixes the last characters of a name into its high bits,
+    // so names like "bone_1" and "bone_2" need mixing before they spread
+    // over the buckets.
+    return mix(hash) % n_buckets;
+}
+
+void BoneNameTable::clear()
+{
+    names_.clear();
+    entries_.clear();
+    bone_name_offsets_.clear();
+    bucket_seeds_.clear();
+    slots_.clear();
+}
+
+void BoneNameTable::insert(const char* name, size_t length, uint8_t bone_id)
+{
+    uint32_t name_offset = names_.size();
+    names_.insert(names_.end(), name, name + length);
+    names_.push_back('\0');
+    if (bone_id >= bone_name_offsets_.size()) {
+        bone_name_offsets_.resize(bone_id + 1, UINT32_MAX);
+    }
+    bone_name_offsets_[bone_id] = name_offset;
+    entries_.push_back({hash_name(name, length), name_offset, static_cast<uint32_t>(length), bone_id});
+}
+
+bool BoneNameTable::build()
+{
+    // Drop repeated names, keeping the entry inserted last.
+    std::vector<uint32_t> keys (entries_.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        keys[i] = i;
+    }
+    std::stable_sort(keys.begin(), keys.end(), [this](uint32_t lhs, uint32_t rhs) {
+        return entries_[lhs].hash < entries_[rhs].hash;
+    });
+    auto is_same_name = [this](uint32_t lhs, uint32_t rhs) {
+        const Entry& a = entries_[lhs];
+        const Entry& b = entries_[rhs];
+        return (
+            a.hash == b.hash and a.length == b.length and
+            memcmp(&names_[a.name_offset], &names_[b.name_offset], a.length) == 0
+            );
+    };
+    size_t n_keys = 0;
+    for (size_t i = 0; i < keys.size(); i++) {
+        size_t j = n_keys;
+        while (j > 0 and entries_[keys[j - 1]].hash == entries_[keys[i]].hash) {
+            if (is_same_name(keys[j - 1], keys[i])) break;
+            j--;
+        }
+        if (j > 0 and is_same_name(keys[j - 1], keys[i])) {
+            keys[j - 1] = keys[i];
+        } else {
+            keys[n_keys++] = keys[i];
+        }
+    }
+    keys.resize(n_keys);
+
+    size_t n_buckets = std::max<size_t>(n_keys / 2, 1);
+    bucket_seeds_.assign(n_buckets, 0);
+    slots_.assign(n_keys, UINT32_MAX);
+    std::vector<std::vector<uint32_t>> buckets (n_buckets);
+    for (uint32_t key : keys) {
+        buckets[get_bucket(entries_[key].hash, n_buckets)].push_back(key);
+    }
+    // Place the largest buckets first, while most slots are still free.
+    std::vector<uint32_t> bucket_order (n_buckets);
+    for (size_t i = 0; i < n_buckets; i++) {
+        bucket_order[i] = i;
+    }
+    std::stable_sort(bucket_order.begin(), bucket_order.end(), [&buckets](uint32_t lhs, uint32_t rhs) {
+        return buckets[lhs].size() > buckets[rhs].size();
+    });
+    std::vector<size_t> bucket_slots;
+    for (uint32_t bucket : bucket_order) {
+        const std::vector<uint32_t>& bucket_keys = buckets[bucket];
+        if (bucket_keys.empty()) break;
+        bool is_placed = false;
+        for (uint32_t seed = 0; seed <= UINT16_MAX and not is_placed; seed++) {
+            bucket_slots.clear();
+            for (uint32_t key : bucket_keys) {
+                size_t slot = mix_seed(entries_[key].hash, seed) % n_keys;
+                if (
+                    slots_[slot] != UINT32_MAX or
+                    std::find(bucket_slots.begin(), bucket_slots.end(), slot) != bucket_slots.end()
+                    ) {
+                    break;
+                }
+                bucket_slots.push_back(slot);
+            }
+            if (bucket_slots.size() == bucket_keys.size()) {
+                bucket_seeds_[bucket] = seed;
+                for (size_t i = 0; i < bucket_keys.size(); i++) {
+                    slots_[bucket_slots[i]] = bucket_keys[i];
+                }
+                is_placed = true;
+            }
+        }
+        if (not is_placed) {
+            fprintf(stderr, "Failed to build the bone name hash for %zu names.\n", n_keys);
+            bucket_seeds_.clear();
+            slots_.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t BoneNameTable::get_slot(uint64_t hash) const
+{
+    uint16_t seed = bucket_seeds_[get_bucket(hash, bucket_seeds_.size())];
+    return mix_seed(hash, seed) % slots_.size();
+}
+
+uint8_t BoneNameTable::find(const char* name, size_t length) const
+{
+    if (slots_.empty()) {
+        return INVALID_BONE_ID;
+    }
+    uint64_t hash = hash_name(name, length);
+    const Entry& entry = entries_[slots_[get_slot(hash)]];
+    if (
+        entry.hash != hash or entry.length != length or
+        memcmp(&names_[entry.name_offset], name, length) != 0
+        ) {
+        return INVALID_BONE_ID;
+    }
+    return entry.bone_id;
+}
+
+const char* BoneNameTable::get_name(uint8_t bone_id) const
+{
+    if (bone_id >= bone_name_offsets_.size() or bone_name_offsets_[bone_id] == UINT32_MAX) {
+        return "";
+    }
+    return &names_[bone_name_offsets_[bone_id]];
+}
+
+size_t BoneNameTable::size() const
+{
+    return slots_.size();
+}
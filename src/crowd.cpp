@@ -0,0 +1,191 @@
+#include "crowd.hpp"
+#include <algorithm>
+#include <cmath>
+
+static bool is_bbox_visible(const BoundingBox& bbox, const glm::mat4& mvp)
+{
+    // Conservative: only rejects boxes with every corner outside one plane.
+    glm::vec4 corners[8];
+    for (size_t i = 0; i < 8; i++) {
+        glm::vec3 corner {
+            (i & 1) ? bbox.max.x : bbox.min.x,
+            (i & 2) ? bbox.max.y : bbox.min.y,
+            (i & 4) ? bbox.max.z : bbox.min.z
+        };
+        corners[i] = mvp * glm::vec4{corner, 1.f};
+    }
+    for (size_t axis = 0; axis < 3; axis++) {
+        bool all_below = true;
+        bool all_above = true;
+        for (const glm::vec4& corner : corners) {
+            all_below = all_below and corner[axis] < -corner.w;
+            all_above = all_above and corner[axis] > corner.w;
+        }
+        if (all_below or all_above) return false;
+    }
+    return true;
+}
+
+size_t PoseCache::KeyHash::operator()(const Key& key) const
+{
+    size_t hash = std::hash<const void*>{}(key.model);
+    hash = hash * 31 + std::hash<const void*>{}(key.animation);
+    hash = hash * 31 + std::hash<int64_t>{}(key.tick);
+    hash = hash * 31 + (key.has_mask ? std::hash<BoneSet>{}(key.mask) : 0);
+    return hash * 31 + key.lod;
+}
+
+PoseCache::PoseCache(ModelManager* mm, float time_quantum)
+  : mm_ {mm}
+  , time_quantum_ {time_quantum}
+{
+}
+
+void PoseCache::set_time_quantum(float time_quantum)
+{
+    // Existing entries stay valid for instances holding them but are no
+    // longer shared, and age out as usual.
+    time_quantum_ = time_quantum;
+    lookup_.clear();
+}
+
+void PoseCache::begin_frame()
+{
+    // Lookup entries of recycled palettes are left in place and rejected by
+    // their key or free flag, so once every (clip, tick, LOD) key has been
+    // seen the lookup stops allocating.
+    for (PaletteHandle i = 0; i < entries_.size(); i++) {
+        Entry& entry = entries_[i];
+        if (not entry.is_free and entry.last_used_frame + 1 == frame_) {
+            entry.is_free = true;
+            free_entries_.push_back(i);
+        }
+    }
+    frame_++;
+    stats_ = PoseCacheStats{};
+}
+
+PaletteHandle PoseCache::acquire(
+        Model* model,
+        Animation* animation,
+        float time,
+        size_t lod,
+        const BoneSet* bone_mask
+        )
+{
+    // Quantize looped time so instances a whole number of loops apart share.
+    float ticks_per_quantum = time_quantum_ * ANIMATION_TICKS_PER_SECOND;
+    int64_t n_quanta = std::max<int64_t>(1, std::llround(animation->duration / ticks_per_quantum));
+    int64_t tick = std::llround(time * ANIMATION_TICKS_PER_SECOND / ticks_per_quantum) % n_quanta;
+    if (tick < 0) tick += n_quanta;
+    Key key {model, animation, tick, lod, bone_mask != nullptr, bone_mask ? *bone_mask : BoneSet{}};
+
+    PaletteHandle& found_h = lookup_[key];
+    if (found_h < entries_.size()) {
+        Entry& found = entries_[found_h];
+        if (not found.is_free and found.key == key) {
+            found.last_used_frame = frame_;
+            stats_.n_hits++;
+            return found_h;
+        }
+    }
+
+    PaletteHandle palette_h;
+    if (not free_entries_.empty()) {
+        palette_h = free_entries_.back();
+        free_entries_.pop_back();
+    } else {
+        palette_h = entries_.size();
+        entries_.emplace_back();
+    }
+    Entry& entry = entries_[palette_h];
+    entry.key = key;
+    entry.is_free = false;
+    entry.last_used_frame = frame_;
+    mm_->update_pose(model, local_pose_, animation, tick * time_quantum_, lod, bone_mask);
+    mm_->convert_local_to_global_pose(entry.palette, model, local_pose_, true, lod, bone_mask);
+    mm_->compute_pose_bbox(entry.bbox, model, entry.palette, lod);
+    found_h = palette_h;
+    stats_.n_misses++;
+    return palette_h;
+}
+
+void PoseCache::retain(PaletteHandle palette_h)
+{
+    entries_[palette_h].last_used_frame = frame_;
+}
+
+const Pose& PoseCache::get_palette(PaletteHandle palette_h) const
+{
+    return entries_[palette_h].palette;
+}
+
+const BoundingBox& PoseCache::get_bbox(PaletteHandle palette_h) const
+{
+    return entries_[palette_h].bbox;
+}
+
+const PoseCacheStats& PoseCache::get_stats() const
+{
+    return stats_;
+}
+
+AnimationScheduler::AnimationScheduler(ModelManager* mm, PoseCache* cache)
+  : mm_ {mm}
+  , cache_ {cache}
+{
+}
+
+size_t AnimationScheduler::get_update_interval(size_t lod, bool is_visible) const
+{
+    if (not is_visible) return 4;
+    if (lod == 0) return 1;
+    if (lod == 1) return 2;
+    return 4;
+}
+
+void AnimationScheduler::update(
+        std::vector<Instance>& instances,
+        float time,
+        const glm::mat4& projection,
+        const glm::mat4& view
+        )
+{
+    stats_ = SchedulerStats{};
+    for (size_t i = 0; i < instances.size(); i++) {
+        Instance& instance = instances[i];
+        glm::mat4 model_view = view * instance.transform;
+        instance.lod = mm_->select_lod(instance.model, projection, model_view);
+        // Culled against the bounds of the pose the instance last held, which
+        // follow the clip where the bind pose bounds would not.
+        const BoundingBox& bbox = instance.has_pose ? cache_->get_bbox(instance.palette_h) : instance.model->bbox;
+        bool is_visible = is_bbox_visible(bbox, projection * model_view);
+        size_t interval = get_update_interval(instance.lod, is_visible);
+
+        // A held pose evaluated at a coarser skeleton LOD lacks the bones a
+        // finer LOD needs, so it is refreshed immediately.
+        bool is_due = (frame_ + i) % interval == 0;
+        bool is_stale = not instance.has_pose or instance.lod < instance.pose_lod;
+        if (is_due or is_stale) {
+            instance.palette_h = cache_->acquire(
+                instance.model,
+                instance.animation,
+                time + instance.time_offset,
+                instance.lod,
+                instance.bone_mask
+                );
+            instance.has_pose = true;
+            instance.pose_lod = instance.lod;
+            stats_.n_evaluated++;
+        } else {
+            cache_->retain(instance.palette_h);
+            stats_.n_skipped++;
+        }
+    }
+    frame_++;
+}
+
+const SchedulerStats& AnimationScheduler::get_stats() const
+{
+    return stats_;
+}
@@ -75,18 +75,29 @@ void DrawUtil::draw(
         const glm::mat4& view,
         const std::vector<VertPC>& vertices
         )
+{
+    draw(mode, projection, view, vertices.data(), vertices.size());
+}
+
+void DrawUtil::draw(
+        GLenum mode,
+        const glm::mat4& projection,
+        const glm::mat4& view,
+        const VertPC* vertices,
+        size_t n_vertices
+        )
 {
     glBindVertexArray(vao_);
     glUseProgram(program_);
     glBindBuffer(GL_ARRAY_BUFFER, vbo_);
     glUniformMatrix4fv(loc_projection_, 1, GL_FALSE, glm::value_ptr(projection));
     glUniformMatrix4fv(loc_view_, 1, GL_FALSE, glm::value_ptr(view));
-    for (size_t i = 0; i < vertices.size(); i += BATCH_SIZE) {
+    for (size_t i = 0; i < n_vertices; i += BATCH_SIZE) {
         size_t batch_size = BATCH_SIZE;
-        if (i + BATCH_SIZE > vertices.size()) {
-            batch_size = vertices.size() - i;
+        if (i + BATCH_SIZE > n_vertices) {
+            batch_size = n_vertices - i;
         }
-        glBufferSubData(GL_ARRAY_BUFFER, 0, batch_size * sizeof(VertPC), vertices.data());
+        glBufferSubData(GL_ARRAY_BUFFER, 0, batch_size * sizeof(VertPC), vertices + i);
         glDrawArrays(mode, 0, batch_size);
     }
 }
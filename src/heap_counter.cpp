@@ -0,0 +1,52 @@
+#include "arena.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <malloc.h>
+
+// Replaces the global operator new and delete to keep get_heap_counts()
+// current. Linked into the viewer and benchmarks only, so the libraries
+// leave the process allocator alone.
+
+static const bool is_enabled = (enable_heap_counting(), true);
+
+void* operator new(size_t size)
+{
+    void* ptr = std::malloc(size > 0 ? size : 1);
+    if (ptr == nullptr) {
+        throw std::bad_alloc{};
+    }
+    HeapCounts& counts = get_heap_counts();
+    counts.n_allocations++;
+    counts.live_bytes += malloc_usable_size(ptr);
+    counts.peak_live_bytes = std::max(counts.peak_live_bytes, counts.live_bytes);
+    return ptr;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    if (ptr != nullptr) {
+        get_heap_counts().live_bytes -= malloc_usable_size(ptr);
+    }
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    operator delete(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    operator delete(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept
+{
+    operator delete(ptr);
+}
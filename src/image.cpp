@@ -85,3 +85,40 @@ GLuint ImageLoader::make_texture_from_image(const char* path)
 
     return tex;
 }
+
+GLuint ImageLoader::make_texture_from_pixels(const std::vector<uint8_t>& pixels, size_t width, size_t height)
+{
+    GLuint tex = 0u;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    return tex;
+}
+
+bool ImageLoader::load_image_pixels(std::vector<uint8_t>& pixels, size_t& width, size_t& height, const char* path)
+{
+    ILuint img = 0u;
+    ilGenImages(1, &img);
+    ilBindImage(img);
+
+    bool ok = ilLoadImage(path) and ilConvertImage(IL_RGBA, IL_UNSIGNED_BYTE);
+    if (ok) {
+        ILinfo img_info;
+        iluGetImageInfo(&img_info);
+        if (img_info.Origin == IL_ORIGIN_UPPER_LEFT) {
+            iluFlipImage();
+        }
+        width = img_info.Width;
+        height = img_info.Height;
+        const uint8_t* data = ilGetData();
+        pixels.assign(data, data + 4 * width * height);
+    } else {
+        fprintf(stderr, "Failed to load image \"%s\".\n", path);
+    }
+
+    ilBindImage(0u);
+    ilDeleteImage(img);
+    return ok;
+}
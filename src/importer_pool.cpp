@@ -0,0 +1,108 @@
+#include "importer_pool.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <utility>
+
+SceneHandle::SceneHandle(SceneHandle&& that)
+  : pool_ {that.pool_}
+  , importer_id_ {that.importer_id_}
+  , scene_ {that.scene_}
+{
+    that.pool_ = nullptr;
+    that.scene_ = nullptr;
+}
+
+SceneHandle& SceneHandle::operator=(SceneHandle&& that)
+{
+    if (this != &that) {
+        release();
+        std::swap(pool_, that.pool_);
+        std::swap(importer_id_, that.importer_id_);
+        std::swap(scene_, that.scene_);
+    }
+    return *this;
+}
+
+SceneHandle::~SceneHandle()
+{
+    release();
+}
+
+const aiScene* SceneHandle::get_scene() const
+{
+    return scene_;
+}
+
+const std::vector<std::string>& SceneHandle::get_requested_paths() const
+{
+    return pool_->io_systems_[importer_id_]->get_requested_paths();
+}
+
+void SceneHandle::release()
+{
+    if (pool_ != nullptr) {
+        pool_->release(importer_id_);
+    }
+    pool_ = nullptr;
+    scene_ = nullptr;
+}
+
+ImporterPool::ImporterPool(size_t n_importers)
+{
+    n_importers = std::max<size_t>(n_importers, 1);
+    for (size_t i = 0; i < n_importers; i++) {
+        importers_.emplace_back(new Assimp::Importer);
+        io_systems_.push_back(new MappedIOSystem);
+        importers_.back()->SetIOHandler(io_systems_.back());
+        free_importers_.push_back(i);
+    }
+}
+
+bool ImporterPool::mount_pack(const char* path)
+{
+    // Every mapping of the pack shares the same page cache pages.
+    std::lock_guard<std::mutex> lock {mutex_};
+    for (MappedIOSystem* io_system : io_systems_) {
+        if (not io_system->mount_pack(path)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+SceneHandle ImporterPool::read_file(const char* path, unsigned int post_process_flags)
+{
+    size_t importer_id;
+    {
+        std::unique_lock<std::mutex> lock {mutex_};
+        importer_freed_.wait(lock, [this] { return not free_importers_.empty(); });
+        importer_id = free_importers_.back();
+        free_importers_.pop_back();
+    }
+    SceneHandle handle;
+    handle.pool_ = this;
+    handle.importer_id_ = importer_id;
+    // The importer is checked out to this thread, so its log is too.
+    io_systems_[importer_id]->clear_requested_paths();
+    handle.scene_ = importers_[importer_id]->ReadFile(path, post_process_flags);
+    if (handle.scene_ == nullptr) {
+        fprintf(stderr, "Failed to parse \"%s\": %s\n", path, importers_[importer_id]->GetErrorString());
+        handle.release();
+    }
+    return handle;
+}
+
+size_t ImporterPool::size() const
+{
+    return importers_.size();
+}
+
+void ImporterPool::release(size_t importer_id)
+{
+    importers_[importer_id]->FreeScene();
+    {
+        std::lock_guard<std::mutex> lock {mutex_};
+        free_importers_.push_back(importer_id);
+    }
+    importer_freed_.notify_one();
+}
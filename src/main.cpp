@@ -1,6 +1,15 @@
+#include "arena.hpp"
+#include "crowd.hpp"
+#include "draw.hpp"
 #include "image.hpp"
 #include "model.hpp"
+#include "shader.hpp"
+#include "skinning.hpp"
+#include "vat.hpp"
 #include <cstdio>
+#include <cstring>
+#include <string>
+#include <unistd.h>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <glm/gtc/matrix_transform.hpp>
@@ -16,6 +25,15 @@ float distance = 5.f;
 double mouse_press_x = 0.f;
 double mouse_press_y = 0.f;
 
+enum class CrowdMode
+{
+    CACHED_POSES,
+    BAKED_PALETTES,
+    VERTEX_ANIMATION,
+};
+
+CrowdMode crowd_mode = CrowdMode::CACHED_POSES;
+
 void update_view()
 {
     glm::vec3 offset = distance * glm::vec3{
@@ -61,6 +79,17 @@ void on_mouse_button(GLFWwindow* window, int button, int action, int mods)
     } 
 }
 
+void on_key(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+    if (key == GLFW_KEY_B and action == GLFW_PRESS) {
+        switch (crowd_mode) {
+        case CrowdMode::CACHED_POSES: crowd_mode = CrowdMode::BAKED_PALETTES; break;
+        case CrowdMode::BAKED_PALETTES: crowd_mode = CrowdMode::VERTEX_ANIMATION; break;
+        case CrowdMode::VERTEX_ANIMATION: crowd_mode = CrowdMode::CACHED_POSES; break;
+        }
+    }
+}
+
 void make_grid(std::vector<VertPC>& grid, int size, const glm::vec3& color)
 {
     float half_size = size / 2.f;
@@ -72,8 +101,194 @@ void make_grid(std::vector<VertPC>& grid, int size, const glm::vec3& color)
     }
 }
 
-int main()
+void frame_bbox(const BoundingBox& bbox)
+{
+    target = (bbox.min + bbox.max) / 2.f;
+    distance = glm::length(bbox.max - bbox.min) / 2.f;
+    min_distance = distance * 0.8f;
+    max_distance = distance * 100.f;
+    update_view();
+}
+
+// The default view: one model playing its clip, with its skeleton on top.
+void run_viewer(
+        GLFWwindow* window,
+        ModelManager& mm,
+        DrawUtil& du,
+        const std::vector<VertPC>& grid,
+        Model* model,
+        Animation* animation,
+        const glm::mat4& projection
+        )
+{
+    // Bones the clip does not move stay clean in the pose state, so their
+    // transforms are neither recomposed nor uploaded again.
+    LocalPose pose;
+    PoseState state;
+    mm.init_pose_state(&state, model);
+    BoundingBox bbox;
+    bool is_framed = false;
+    while (not glfwWindowShouldClose(window)) {
+        glfwPollEvents();
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        mm.update_pose(model, pose, animation, glfwGetTime());
+        mm.set_local_pose(&state, model, pose);
+        mm.update_global_pose(&state, model);
+        // The camera is framed on the first animated pose and then keeps the
+        // posed mesh centered, since the clip can carry it off its bind pose.
+        mm.compute_pose_bbox(bbox, model, state.palette);
+        if (not is_framed) {
+            frame_bbox(bbox);
+            is_framed = true;
+        } else {
+            target = (bbox.min + bbox.max) / 2.f;
+            update_view();
+        }
+        glEnable(GL_DEPTH_TEST);
+        mm.draw_model_state(model, &state, projection, view);
+        du.draw(GL_LINES, projection, view, grid);
+        glDisable(GL_DEPTH_TEST);
+        mm.draw_skeleton(model, pose, projection, view);
+        glfwSwapBuffers(window);
+        get_frame_arena().reset();
+    }
+}
+
+// A grid of instances of one model, drawn from scheduled and cached poses,
+// baked palettes or vertex animation; B cycles between them. The vertex
+// animation comes from vat_path if it is given and matches the model, and
+// is baked here otherwise.
+void run_crowd(
+        GLFWwindow* window,
+        ModelManager& mm,
+        DrawUtil& du,
+        const std::vector<VertPC>& grid,
+        Model* model,
+        Animation* animation,
+        const glm::mat4& projection,
+        const char* vat_path
+        )
 {
+    glfwSetKeyCallback(window, on_key);
+
+    BakedAnimation baked;
+    mm.bake_animation(&baked, model, animation, 30.f);
+    VertexAnimation vat;
+    bool has_vat = vat_path and read_vertex_animation(&vat, vat_path);
+    if (has_vat and vat.n_vertices != model->vertices.size()) {
+        fprintf(
+            stderr, "Failed to use \"%s\": it animates %zu vertices, not %zu.\n",
+            vat_path, vat.n_vertices, model->vertices.size()
+            );
+        has_vat = false;
+    }
+    if (not has_vat) {
+        Skinner skinner;
+        skinner.init();
+        mm.bake_vertex_animation(&vat, &skinner, model, animation, 30.f);
+    }
+    mm.upload_vertex_animation(&vat);
+
+    const int crowd_size = 7;
+    glm::vec3 extent = model->bbox.max - model->bbox.min;
+    float spacing = 1.5f * glm::max(extent.x, extent.z);
+    BoneSet crowd_bones;
+    mm.compute_required_bones(crowd_bones, model, MeshSet{}.set());
+    printf("Crowd evaluates %zu of %zu bones.\n", crowd_bones.count(), model->n_bones);
+    std::vector<Instance> crowd;
+    for (int i = 0; i < crowd_size * crowd_size; i++) {
+        Instance instance;
+        instance.model = model;
+        instance.animation = animation;
+        instance.bone_mask = &crowd_bones;
+        glm::vec3 position {
+            (i % crowd_size - crowd_size / 2) * spacing,
+            0.f,
+            (i / crowd_size - crowd_size / 2) * spacing
+        };
+        instance.transform = glm::translate(glm::mat4{1.f}, position);
+        instance.time_offset = 0.25f * (i % 4);
+        crowd.push_back(instance);
+    }
+    Instance& hero = crowd[crowd.size() / 2];
+    LocalPose hero_pose;
+    PoseCache pose_cache {&mm};
+    AnimationScheduler scheduler {&mm, &pose_cache};
+    size_t frame = 0;
+    size_t heap_allocations = get_heap_counts().n_allocations;
+
+    while (not glfwWindowShouldClose(window)) {
+        glfwPollEvents();
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        float time = glfwGetTime();
+        glEnable(GL_DEPTH_TEST);
+        if (crowd_mode == CrowdMode::CACHED_POSES) {
+            pose_cache.begin_frame();
+            scheduler.update(crowd, time, projection, view);
+            for (const Instance& instance : crowd) {
+                const Pose& palette = pose_cache.get_palette(instance.palette_h);
+                mm.draw_model_palette(instance.model, palette, projection, view * instance.transform, instance.lod);
+            }
+        } else {
+            for (Instance& instance : crowd) {
+                glm::mat4 model_view = view * instance.transform;
+                instance.lod = mm.select_lod(instance.model, projection, model_view);
+                instance.has_pose = false;
+                if (crowd_mode == CrowdMode::BAKED_PALETTES) {
+                    mm.draw_model_baked(
+                        instance.model, &baked, time + instance.time_offset,
+                        projection, model_view, instance.lod
+                        );
+                } else {
+                    mm.draw_model_vat(
+                        instance.model, &vat, time + instance.time_offset,
+                        projection, model_view, instance.lod
+                        );
+                }
+            }
+        }
+        du.draw(GL_LINES, projection, view, grid);
+        glDisable(GL_DEPTH_TEST);
+        mm.update_pose(hero.model, hero_pose, hero.animation, time + hero.time_offset, hero.lod);
+        mm.draw_skeleton(hero.model, hero_pose, projection, view * hero.transform, hero.lod);
+        glfwSwapBuffers(window);
+        get_frame_arena().reset();
+        if (++frame % 120 == 0) {
+            const SchedulerStats& stats = scheduler.get_stats();
+            const PoseCacheStats& cache_stats = pose_cache.get_stats();
+            size_t new_heap_allocations = get_heap_counts().n_allocations;
+            printf(
+                "Poses evaluated: %zu, skipped: %zu, cache hits: %zu, misses: %zu, heap allocations: %zu.\n",
+                stats.n_evaluated, stats.n_skipped, cache_stats.n_hits, cache_stats.n_misses,
+                new_heap_allocations - heap_allocations
+                );
+            heap_allocations = new_heap_allocations;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    // Usage: model_loading [--crowd] [--cache <dir>] [--vat <path>] [import profile]
+    // --cache loads the model from the output directory of
+    // tools/convert_assets run on models/, instead of importing it. --vat
+    // gives the crowd a vertex animation written by tools/bake_vat.
+    bool is_crowd = false;
+    const char* cache_dir = nullptr;
+    const char* vat_path = nullptr;
+    ImportProfile import_profile = ImportProfile::PRODUCTION;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--crowd") == 0) {
+            is_crowd = true;
+        } else if (strcmp(argv[i], "--cache") == 0 and i + 1 < argc) {
+            cache_dir = argv[++i];
+        } else if (strcmp(argv[i], "--vat") == 0 and i + 1 < argc) {
+            vat_path = argv[++i];
+        } else if (not find_import_profile(import_profile, argv[i])) {
+            return -1;
+        }
+    }
+
     if (not glfwInit()) {
         fprintf(stderr, "Failed to initialize GLFW.\n");
     }
@@ -121,36 +336,37 @@ int main()
         return -1;
     }
 
+    const char* asset_pack_path = "models/assets.pack";
+    if (access(asset_pack_path, R_OK) == 0 and not mm.mount_asset_pack(asset_pack_path)) {
+        return -1;
+    }
+
     std::vector<VertPC> grid;
     make_grid(grid, 10, glm::vec3{0.3f, 0.3f, 0.3f});
 
     Model mario;
     Animation mario_walk;
-    mm.analyze_model("models/mario/mario.fbx");
-    mm.load_model(&mario, &mario_walk, "models/mario/mario.fbx");
-    Pose pose = mario.default_pose;
+    if (cache_dir) {
+        std::string cache_path = std::string{cache_dir} + "/mario/mario.fbx";
+        if (not mm.load_cached_model(&mario, &mario_walk, cache_path.c_str())) {
+            return -1;
+        }
+    } else {
+        mm.analyze_model("models/mario/mario.fbx");
+        mm.load_model(&mario, &mario_walk, "models/mario/mario.fbx", import_profile);
+    }
 
-    target = (mario.bbox.min + mario.bbox.max) / 2.f;
-    distance = glm::length(mario.bbox.max - mario.bbox.min) / 2.f;
-    min_distance = distance * 0.8f;
-    max_distance = distance * 100.f;
-    update_view();
+    frame_bbox(mario.bbox);
 
     float aspect = static_cast<float>(window_width) / window_height;
     glm::mat4 projection = glm::perspective(1.f, aspect, 0.1f, 1000.f);
 
     glClearColor(0.5f, 0.5f, 0.5f, 0.f);
 
-    while (not glfwWindowShouldClose(window)) {
-        glfwPollEvents();
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        mm.update_pose(&mario, pose, &mario_walk, glfwGetTime());
-        glEnable(GL_DEPTH_TEST);
-        mm.draw_model(&mario, pose, projection, view);
-        du.draw(GL_LINES, projection, view, grid);
-        glDisable(GL_DEPTH_TEST);
-        mm.draw_skeleton(&mario, pose, projection, view);
-        glfwSwapBuffers(window);
+    if (is_crowd) {
+        run_crowd(window, mm, du, grid, &mario, &mario_walk, projection, vat_path);
+    } else {
+        run_viewer(window, mm, du, grid, &mario, &mario_walk, projection);
     }
 
     glfwTerminate();
@@ -0,0 +1,347 @@
+#include "mapped_io.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char PACK_MAGIC[4] = {'P', 'A', 'K', '1'};
+static const size_t PACK_ALIGNMENT = 16;
+static const size_t RELEASE_GRANULARITY = 1 << 20;
+
+// A pack is this header, n_files entries, the paths back to back and then
+// the file contents, each starting on a PACK_ALIGNMENT boundary.
+struct PackHeader
+{
+    char magic[4];
+    uint32_t n_files;
+};
+
+struct PackEntry
+{
+    uint64_t data_offset;
+    uint64_t size;
+    uint32_t path_offset;
+    uint32_t path_length;
+};
+
+namespace {
+
+class MappedIOStream : public Assimp::IOStream
+{
+public:
+    MappedIOStream(const char* data, size_t size, std::unique_ptr<MappedFile> file)
+      : file_ {std::move(file)}
+      , data_ {data}
+      , size_ {size}
+    {
+    }
+
+    size_t Read(void* buffer, size_t size, size_t count) override
+    {
+        if (size == 0) return 0;
+        size_t n_items = std::min(count, (size_ - position_) / size);
+        // Copy in chunks so large reads release pages as they go.
+        char* out = static_cast<char*>(buffer);
+        size_t end = position_ + n_items * size;
+        while (position_ < end) {
+            size_t n_bytes = std::min(end - position_, RELEASE_GRANULARITY);
+            std::memcpy(out, data_ + position_, n_bytes);
+            out += n_bytes;
+            position_ += n_bytes;
+            release_read_pages();
+        }
+        return n_items;
+    }
+
+    size_t Write(const void* buffer, size_t size, size_t count) override
+    {
+        return 0;
+    }
+
+    aiReturn Seek(size_t offset, aiOrigin origin) override
+    {
+        size_t base = 0;
+        switch (origin) {
+        case aiOrigin_SET: base = 0; break;
+        case aiOrigin_CUR: base = position_; break;
+        case aiOrigin_END: base = size_; break;
+        default: return aiReturn_FAILURE;
+        }
+        // Offsets from the end arrive as negative numbers wrapped to size_t.
+        size_t position = base + offset;
+        if (position > size_) {
+            return aiReturn_FAILURE;
+        }
+        position_ = position;
+        return aiReturn_SUCCESS;
+    }
+
+    size_t Tell() const override
+    {
+        return position_;
+    }
+
+    size_t FileSize() const override
+    {
+        return size_;
+    }
+
+    void Flush() override
+    {
+    }
+
+private:
+    // Mapped pages count towards the resident set, and importers copy what
+    // they read into buffers of their own. Dropping pages once they have
+    // been read keeps the file from being resident twice; they are clean,
+    // so reading them again just faults them back in from the page cache.
+    void release_read_pages()
+    {
+        uintptr_t page_size = sysconf(_SC_PAGESIZE);
+        uintptr_t begin = reinterpret_cast<uintptr_t>(data_ + released_);
+        begin = (begin + page_size - 1) / page_size * page_size;
+        uintptr_t end = reinterpret_cast<uintptr_t>(data_ + position_) / page_size * page_size;
+        if (end >= begin + RELEASE_GRANULARITY) {
+            madvise(reinterpret_cast<void*>(begin), end - begin, MADV_DONTNEED);
+            released_ = end - reinterpret_cast<uintptr_t>(data_);
+        }
+    }
+
+    // Null for files served from a pack, which owns their memory instead.
+    std::unique_ptr<MappedFile> file_;
+    const char* data_;
+    size_t size_;
+    size_t position_ = 0;
+    size_t released_ = 0;
+};
+
+}
+
+MappedFile::~MappedFile()
+{
+    if (data_ != nullptr) {
+        munmap(data_, size_);
+    }
+}
+
+bool MappedFile::open(const char* path)
+{
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 or not S_ISREG(info.st_mode)) {
+        close(fd);
+        return false;
+    }
+    size_t size = static_cast<size_t>(info.st_size);
+    void* data = nullptr;
+    if (size > 0) {
+        data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        // Importers mostly read front to back; let the kernel read ahead.
+        madvise(data, size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+    if (data_ != nullptr) {
+        munmap(data_, size_);
+    }
+    data_ = data;
+    size_ = size;
+    return true;
+}
+
+const char* MappedFile::get_data() const
+{
+    return static_cast<const char*>(data_);
+}
+
+size_t MappedFile::get_size() const
+{
+    return size_;
+}
+
+bool MappedIOSystem::mount_pack(const char* path)
+{
+    std::unique_ptr<MappedFile> pack {new MappedFile};
+    if (not pack->open(path)) {
+        fprintf(stderr, "Failed to open asset pack \"%s\".\n", path);
+        return false;
+    }
+    const char* data = pack->get_data();
+    size_t size = pack->get_size();
+    PackHeader header;
+    if (size < sizeof(header)) {
+        fprintf(stderr, "Failed to read asset pack \"%s\".\n", path);
+        return false;
+    }
+    std::memcpy(&header, data, sizeof(header));
+    size_t entries_end = sizeof(header) + header.n_files * sizeof(PackEntry);
+    if (std::memcmp(header.magic, PACK_MAGIC, sizeof(PACK_MAGIC)) != 0 or entries_end > size) {
+        fprintf(stderr, "Failed to read asset pack \"%s\".\n", path);
+        return false;
+    }
+    std::vector<PackFile> files;
+    for (size_t i = 0; i < header.n_files; i++) {
+        PackEntry entry;
+        std::memcpy(&entry, data + sizeof(header) + i * sizeof(PackEntry), sizeof(entry));
+        if (
+            entry.path_offset + uint64_t{entry.path_length} > size or
+            entry.data_offset > size or entry.size > size - entry.data_offset
+            ) {
+            fprintf(stderr, "Failed to read asset pack \"%s\", entry %zu is out of bounds.\n", path, i);
+            return false;
+        }
+        files.push_back({
+            data + entry.path_offset,
+            entry.path_length,
+            data + entry.data_offset,
+            static_cast<size_t>(entry.size)
+            });
+    }
+    pack_files_.insert(pack_files_.end(), files.begin(), files.end());
+    std::stable_sort(pack_files_.begin(), pack_files_.end(), [](const PackFile& lhs, const PackFile& rhs) {
+        int order = std::memcmp(lhs.path, rhs.path, std::min(lhs.path_length, rhs.path_length));
+        return order < 0 or (order == 0 and lhs.path_length < rhs.path_length);
+    });
+    packs_.push_back(std::move(pack));
+    printf("Mounted asset pack \"%s\" with %u files.\n", path, header.n_files);
+    return true;
+}
+
+const MappedIOSystem::PackFile* MappedIOSystem::find_pack_file(const char* path) const
+{
+    size_t path_length = strlen(path);
+    auto compare = [](const PackFile& file, const std::pair<const char*, size_t>& key) {
+        int order = std::memcmp(file.path, key.first, std::min(file.path_length, key.second));
+        return order < 0 or (order == 0 and file.path_length < key.second);
+    };
+    auto key = std::make_pair(path, path_length);
+    auto it = std::lower_bound(pack_files_.begin(), pack_files_.end(), key, compare);
+    const PackFile* found = nullptr;
+    for (; it != pack_files_.end(); ++it) {
+        if (it->path_length != path_length or std::memcmp(it->path, path, path_length) != 0) break;
+        found = &*it;
+    }
+    return found;
+}
+
+bool MappedIOSystem::Exists(const char* path) const
+{
+    add_requested_path(path);
+    if (find_pack_file(path) != nullptr) {
+        return true;
+    }
+    struct stat info;
+    return stat(path, &info) == 0 and S_ISREG(info.st_mode);
+}
+
+char MappedIOSystem::getOsSeparator() const
+{
+    return '/';
+}
+
+Assimp::IOStream* MappedIOSystem::Open(const char* path, const char* mode)
+{
+    if (std::strpbrk(mode, "wa+") != nullptr) {
+        return nullptr;
+    }
+    add_requested_path(path);
+    const PackFile* pack_file = find_pack_file(path);
+    if (pack_file != nullptr) {
+        return new MappedIOStream {pack_file->data, pack_file->size, nullptr};
+    }
+    std::unique_ptr<MappedFile> file {new MappedFile};
+    if (not file->open(path)) {
+        return nullptr;
+    }
+    const char* data = file->get_data();
+    size_t size = file->get_size();
+    return new MappedIOStream {data, size, std::move(file)};
+}
+
+void MappedIOSystem::Close(Assimp::IOStream* stream)
+{
+    delete stream;
+}
+
+const std::vector<std::string>& MappedIOSystem::get_requested_paths() const
+{
+    return requested_paths_;
+}
+
+void MappedIOSystem::clear_requested_paths()
+{
+    requested_paths_.clear();
+}
+
+void MappedIOSystem::add_requested_path(const char* path) const
+{
+    // Importers ask for a handful of files, so a linear scan is enough.
+    if (std::find(requested_paths_.begin(), requested_paths_.end(), path) == requested_paths_.end()) {
+        requested_paths_.push_back(path);
+    }
+}
+
+static size_t align_up(size_t offset, size_t alignment)
+{
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+bool write_asset_pack(const char* pack_path, const std::vector<std::string>& paths)
+{
+    std::vector<MappedFile> files (paths.size());
+    std::vector<PackEntry> entries (paths.size());
+    size_t offset = sizeof(PackHeader) + paths.size() * sizeof(PackEntry);
+    for (size_t i = 0; i < paths.size(); i++) {
+        if (not files[i].open(paths[i].c_str())) {
+            fprintf(stderr, "Failed to open \"%s\".\n", paths[i].c_str());
+            return false;
+        }
+        entries[i].path_offset = offset;
+        entries[i].path_length = paths[i].size();
+        offset += paths[i].size();
+    }
+    for (size_t i = 0; i < paths.size(); i++) {
+        offset = align_up(offset, PACK_ALIGNMENT);
+        entries[i].data_offset = offset;
+        entries[i].size = files[i].get_size();
+        offset += files[i].get_size();
+    }
+
+    FILE* file = fopen(pack_path, "wb");
+    if (file == nullptr) {
+        fprintf(stderr, "Failed to open \"%s\" for writing.\n", pack_path);
+        return false;
+    }
+    PackHeader header;
+    std::memcpy(header.magic, PACK_MAGIC, sizeof(PACK_MAGIC));
+    header.n_files = paths.size();
+    bool ok = (
+        fwrite(&header, sizeof(header), 1, file) == 1 and
+        fwrite(entries.data(), sizeof(PackEntry), entries.size(), file) == entries.size()
+        );
+    for (size_t i = 0; i < paths.size() and ok; i++) {
+        ok = fwrite(paths[i].data(), 1, paths[i].size(), file) == paths[i].size();
+    }
+    const char padding[PACK_ALIGNMENT] = {};
+    for (size_t i = 0; i < paths.size() and ok; i++) {
+        size_t n_padding = entries[i].data_offset - ftell(file);
+        ok = (
+            fwrite(padding, 1, n_padding, file) == n_padding and
+            fwrite(files[i].get_data(), 1, files[i].get_size(), file) == files[i].get_size()
+            );
+    }
+    fclose(file);
+    if (not ok) {
+        fprintf(stderr, "Failed to write \"%s\".\n", pack_path);
+    }
+    return ok;
+}
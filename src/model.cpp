@@ -1,14 +1,26 @@
-#include "image.hpp"
+#include "arena.hpp"
+#include "blend.hpp"
 #include "model.hpp"
-#include "shader.hpp"
-#include <set>
+#include "parallel.hpp"
+#include "simplify.hpp"
+#include "skinning.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
 #include <stack>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include <glm/gtc/type_ptr.hpp>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 static std::string make_prefix(int offset)
 {
@@ -60,50 +72,75 @@ static uint8_t get_min_index(const glm::vec4& v)
     return (v[min_lhs] < v[min_rhs]) ? min_lhs : min_rhs;
 }
 
-static PosRotScale mat4_to_pos_rot_scale(const glm::mat4& mat)
+static void decompose_mat4(const glm::mat4& mat, glm::vec3& position, glm::quat& rotation, glm::vec3& scale)
 {
-    PosRotScale prs;
-    prs.position = glm::vec3(mat[3]);
+    position = glm::vec3(mat[3]);
     glm::mat3 basis = glm::mat3(mat);
     glm::mat3 norm_basis {
         glm::normalize(basis[0]),
         glm::normalize(basis[1]),
         glm::normalize(basis[2])
     };
-    prs.rotation = glm::normalize(glm::quat_cast(norm_basis));
-    glm::mat3 scale = glm::transpose(norm_basis) * basis;
-    prs.scale = glm::vec3{scale[0][0], scale[1][1], scale[2][2]};
-    return prs;
+    rotation = glm::normalize(glm::quat_cast(norm_basis));
+    glm::mat3 scale_basis = glm::transpose(norm_basis) * basis;
+    scale = glm::vec3{scale_basis[0][0], scale_basis[1][1], scale_basis[2][2]};
+}
+
+static const unsigned int PRODUCTION_POST_PROCESS_FLAGS = (
+    aiProcess_Triangulate |
+    aiProcess_JoinIdenticalVertices |
+    aiProcess_LimitBoneWeights |
+    aiProcess_ImproveCacheLocality |
+    aiProcess_RemoveRedundantMaterials |
+    aiProcess_FindInvalidData
+    );
+
+// Indexed by ImportProfile.
+static const ImportSettings IMPORT_SETTINGS[] = {
+    {"fast-preview", aiProcess_Triangulate, 1, false},
+    {"production", PRODUCTION_POST_PROCESS_FLAGS, MAX_LODS, true},
+    {"crowd-LOD", PRODUCTION_POST_PROCESS_FLAGS | aiProcess_OptimizeMeshes, MAX_LODS, true},
+};
+
+const ImportSettings& get_import_settings(ImportProfile profile)
+{
+    return IMPORT_SETTINGS[static_cast<size_t>(profile)];
+}
+
+bool find_import_profile(ImportProfile& profile, const char* name)
+{
+    for (size_t i = 0; i < sizeof(IMPORT_SETTINGS) / sizeof(IMPORT_SETTINGS[0]); i++) {
+        if (strcmp(IMPORT_SETTINGS[i].name, name) == 0) {
+            profile = static_cast<ImportProfile>(i);
+            return true;
+        }
+    }
+    fprintf(stderr, "Failed to find import profile \"%s\".\n", name);
+    return false;
 }
 
 ModelManager::ModelManager(ShaderManager* sm, ImageLoader* il, DrawUtil* du)
   : sm_ {sm}
   , il_ {il}
   , du_ {du}
+  , importers_ {std::thread::hardware_concurrency()}
 {
 }
 
-bool ModelManager::init()
+size_t ModelManager::get_max_concurrent_imports() const
 {
-    GLuint vert, frag;
-    vert = sm_->make_shader(GL_VERTEX_SHADER, "shaders/model.vert");
-    frag = sm_->make_shader(GL_FRAGMENT_SHADER, "shaders/model.frag");
-    program_ = sm_->make_program({vert, frag});
-    glDeleteShader(vert);
-    glDeleteShader(frag);
-    if (program_ == 0u) return false;
-    loc_projection_ = glGetUniformLocation(program_, "projection");
-    loc_view_ = glGetUniformLocation(program_, "view");
-    loc_pose_ = glGetUniformLocation(program_, "pose");
-    loc_diffuse_tex_ = glGetUniformLocation(program_, "diffuse_tex");
+    return importers_.size();
+}
 
-    du_->make_n_colors(bone_colors_, 12);
-    return true;
+bool ModelManager::mount_asset_pack(const char* path)
+{
+    return importers_.mount_pack(path);
 }
 
 bool ModelManager::analyze_model(const char* path)
 {
-    const aiScene* scene = importer_.ReadFile(path, aiProcess_Triangulate);
+    SceneHandle handle = importers_.read_file(path, aiProcess_Triangulate);
+    const aiScene* scene = handle.get_scene();
     if (scene == nullptr) {
         fprintf(stderr, "Failed to load model \"%s\".\n", path);
         return false;
@@ -129,101 +166,182 @@ bool ModelManager::analyze_model(const char* path)
     for (size_t i = 0; i < scene->mNumAnimations; i++) {
         printf("Found animation \"%s\".\n", scene->mAnimations[i]->mName.C_Str());
     }
-
+    return true;
 }
 
-bool ModelManager::gather_bones(
-        std::set<BoneInfo>& included_bones,
-        std::vector<aiNode*>& ai_bone_ends,
-        aiNode* node,
-        bool is_parent_bone,
-        int depth,
-        const glm::mat4& transform,
-        const std::unordered_map<std::string, glm::mat4>& bone_offsets
-        )
+void ModelManager::measure_scene(SceneSizes& sizes, const aiScene* scene, const aiNode* node)
 {
-    glm::mat4 local_transform = ai_to_glm_mat4(node->mTransformation);
-    glm::mat4 full_transform = transform * local_transform;
-    bool should_include = false;
-    glm::mat4 offset;
-    bool is_bone = false;
-    if (bone_offsets.count(node->mName.C_Str()) > 0) {
-        should_include = true;
-        is_bone = true;
-        offset = bone_offsets.at(node->mName.C_Str());
+    sizes.n_nodes++;
+    for (size_t i = 0; i < node->mNumMeshes; i++) {
+        const aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
+        sizes.n_vertices += mesh->mNumVertices;
+        for (size_t j = 0; j < mesh->mNumFaces; j++) {
+            sizes.n_indices += mesh->mFaces[j].mNumIndices;
+        }
+        sizes.n_bone_refs += mesh->mNumBones;
     }
     for (size_t i = 0; i < node->mNumChildren; i++) {
-         if (gather_bones(
-                included_bones,
-                ai_bone_ends,
-                node->mChildren[i],
-                is_bone,
-                depth + 1,
-                full_transform,
-                bone_offsets
-                )) {
-             should_include = true;
-         }
-    }
-    if (should_include) {
-        BoneInfo bone = {
-            depth,
-            node,
-            offset
-        };
-        included_bones.insert(bone);
-    } else if (is_parent_bone) {
-        ai_bone_ends.push_back(node);
-    }
-    return should_include;
-}
-
-void ModelManager::process_bones(Model* model, const aiScene* scene)
-{
-    std::unordered_map<std::string, glm::mat4> bone_offsets;
-    std::stack<std::pair<glm::mat4, aiNode*>> to_explore;
-    to_explore.push({glm::mat4{1.f}, scene->mRootNode});
-    while (not to_explore.empty()) {
-        glm::mat4 transform;
-        aiNode* node;
-        std::tie(transform, node) = to_explore.top();
-        to_explore.pop();
-        glm::mat4 full_transform = transform * ai_to_glm_mat4(node->mTransformation);
-        for (size_t i = 0; i < node->mNumMeshes; i++) {
-            aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            for (size_t j = 0; j < mesh->mNumBones; j++) {
-                aiBone* bone = mesh->mBones[j];
-                bone_offsets[bone->mName.C_Str()] = ai_to_glm_mat4(bone->mOffsetMatrix) * glm::inverse(full_transform);
+        measure_scene(sizes, scene, node->mChildren[i]);
+    }
+}
+
+bool ModelManager::build_skeleton(Model* model, const aiScene* scene)
+{
+    SceneSizes sizes;
+    measure_scene(sizes, scene, scene->mRootNode);
+    LinearArena arena {
+        sizeof(BoneOffset) * sizes.n_bone_refs + sizeof(SceneNode) * sizes.n_nodes +
+        2 * alignof(std::max_align_t)
+    };
+    return process_bones(model, scene, sizes, arena);
+}
+
+bool ModelManager::process_bones(
+        Model* model,
+        const aiScene* scene,
+        const SceneSizes& sizes,
+        LinearArena& arena
+        )
+{
+    // One breadth-first pass flattens the node tree, composing global
+    // transforms and collecting the mesh bones' offsets on the way.
+    SceneNode* nodes = arena.allocate<SceneNode>(sizes.n_nodes);
+    BoneOffset* bone_offsets = arena.allocate<BoneOffset>(sizes.n_bone_refs);
+    size_t n_nodes = 0;
+    size_t n_bone_offsets = 0;
+    nodes[n_nodes++] = {scene->mRootNode, UINT32_MAX, ai_to_glm_mat4(scene->mRootNode->mTransformation)};
+    for (size_t i = 0; i < n_nodes; i++) {
+        const SceneNode& scene_node = nodes[i];
+        aiNode* node = scene_node.node;
+        for (size_t j = 0; j < node->mNumMeshes; j++) {
+            aiMesh* mesh = scene->mMeshes[node->mMeshes[j]];
+            glm::mat4 inverse_transform = glm::inverse(scene_node.transform);
+            for (size_t k = 0; k < mesh->mNumBones; k++) {
+                aiBone* bone = mesh->mBones[k];
+                bone_offsets[n_bone_offsets++] = {
+                    bone->mName.C_Str(),
+                    ai_to_glm_mat4(bone->mOffsetMatrix) * inverse_transform
+                };
             }
         }
-        for (size_t i = 0; i < node->mNumChildren; i++) {
-            to_explore.push({full_transform, node->mChildren[i]});
+        for (size_t j = 0; j < node->mNumChildren; j++) {
+            aiNode* child = node->mChildren[j];
+            nodes[n_nodes++] = {
+                child,
+                static_cast<uint32_t>(i),
+                scene_node.transform * ai_to_glm_mat4(child->mTransformation)
+            };
         }
     }
 
-    std::set<BoneInfo> included_bones;
-    std::vector<aiNode*> ai_bone_ends;
-    gather_bones(included_bones, ai_bone_ends, scene->mRootNode, false, 0, glm::mat4{1.f}, bone_offsets);
+    // Bones shared by several meshes keep the offset seen last.
+    std::stable_sort(
+        bone_offsets, bone_offsets + n_bone_offsets,
+        [](const BoneOffset& lhs, const BoneOffset& rhs) {
+            return strcmp(lhs.name, rhs.name) < 0;
+        });
+    size_t n_unique = 0;
+    for (size_t i = 0; i < n_bone_offsets; i++) {
+        if (n_unique > 0 and strcmp(bone_offsets[n_unique - 1].name, bone_offsets[i].name) == 0) {
+            bone_offsets[n_unique - 1] = bone_offsets[i];
+        } else {
+            bone_offsets[n_unique++] = bone_offsets[i];
+        }
+    }
+    const BoneOffset* offsets_begin = bone_offsets;
+    const BoneOffset* offsets_end = bone_offsets + n_unique;
+    for (size_t i = 0; i < n_nodes; i++) {
+        const char* name = nodes[i].node->mName.C_Str();
+        const BoneOffset* found = std::lower_bound(
+            offsets_begin, offsets_end, name,
+            [](const BoneOffset& offset, const char* key) {
+                return strcmp(offset.name, key) < 0;
+            });
+        bool is_bone = found != offsets_end and strcmp(found->name, name) == 0;
+        nodes[i].bone_offset = is_bone ? found : nullptr;
+        nodes[i].is_included = is_bone;
+    }
+    // Children follow their parents, so a backwards pass carries inclusion
+    // up to every ancestor of a bone.
+    for (size_t i = n_nodes; i-- > 1;) {
+        if (nodes[i].is_included) {
+            nodes[nodes[i].parent].is_included = true;
+        }
+    }
+
+    model->parent_ids.fill(UINT8_MAX);
+    model->default_pose.positions[0] = glm::vec3{0.f, 0.f, 0.f};
+    model->default_pose.rotations[0] = glm::quat{1.f, 0.f, 0.f, 0.f};
+    model->default_pose.scales[0] = glm::vec3{1.f, 1.f, 1.f};
+    model->offsets[0] = glm::mat4{1.f};
+    model->bone_names.clear();
     model->n_bones++;
-    for (auto bone : included_bones) {
+    for (size_t i = 0; i < n_nodes; i++) {
+        SceneNode& scene_node = nodes[i];
+        const SceneNode* parent = scene_node.parent < n_nodes ? &nodes[scene_node.parent] : nullptr;
+        if (not scene_node.is_included) {
+            if (parent and parent->bone_offset) {
+                glm::mat4 transform = ai_to_glm_mat4(scene_node.node->mTransformation);
+                model->bone_ends.push_back({parent->bone_id, glm::vec3{transform[3]}});
+            }
+            continue;
+        }
+        if (model->n_bones >= MAX_BONES) {
+            fprintf(stderr, "Failed to build skeleton, it has more than %zu bones.\n", MAX_BONES - 1);
+            return false;
+        }
         uint8_t bone_id = model->n_bones++;
-        if (bone.node->mName.length > 0) {
-            model->bone_mapping[bone.node->mName.C_Str()] = bone_id;
+        scene_node.bone_id = bone_id;
+        const aiString& name = scene_node.node->mName;
+        if (name.length > 0) {
+            model->bone_names.insert(name.C_Str(), name.length, bone_id);
         }
-        if (bone.node->mParent and model->bone_mapping.count(bone.node->mParent->mName.C_Str()) > 0) {
-            model->parent_ids[bone_id] = model->bone_mapping.at(bone.node->mParent->mName.C_Str());
+        if (parent and parent->is_included) {
+            model->parent_ids[bone_id] = parent->bone_id;
         }
-        model->offsets[bone_id] = bone.offset;
-        model->default_pose[bone_id] = ai_to_glm_mat4(bone.node->mTransformation);
-        model->default_pose_prs[bone_id] = mat4_to_pos_rot_scale(model->default_pose[bone_id]);
+        model->offsets[bone_id] = scene_node.bone_offset ? scene_node.bone_offset->offset : glm::mat4{1.f};
+        decompose_mat4(
+            ai_to_glm_mat4(scene_node.node->mTransformation),
+            model->default_pose.positions[bone_id],
+            model->default_pose.rotations[bone_id],
+            model->default_pose.scales[bone_id]
+            );
+    }
+
+    return model->bone_names.build();
+}
+
+void ModelManager::process_skeleton_lods(Model* model)
+{
+    // Level l drops every bone whose subtree is less than l bones deep, so
+    // leaves (fingers, face, tips) go first and each level peels one more
+    // layer. Roots are always kept so every bone has an evaluated ancestor.
+    std::array<size_t, MAX_BONES> heights;
+    heights.fill(0);
+    for (size_t i = model->n_bones; i-- > 1;) {
+        uint8_t parent_id = model->parent_ids[i];
+        if (parent_id < model->n_bones) {
+            heights[parent_id] = std::max(heights[parent_id], heights[i] + 1);
+        }
+    }
+    model->n_skeleton_lods = 0;
+    for (size_t lod = 0; lod < MAX_LODS; lod++) {
+        BoneSet& bones = model->skeleton_lod_bones[lod];
+        std::array<uint8_t, MAX_BONES>& remap = model->skeleton_lod_remap[lod];
+        bones.reset();
+        for (size_t i = 0; i < model->n_bones; i++) {
+            uint8_t parent_id = model->parent_ids[i];
+            if (parent_id >= model->n_bones or heights[i] >= lod) {
+                bones.set(i);
+                remap[i] = i;
+            } else {
+                remap[i] = remap[parent_id];
+            }
+        }
+        if (lod > 0 and bones == model->skeleton_lod_bones[lod - 1]) break;
+        model->n_skeleton_lods++;
+        printf("Skeleton LOD %zu evaluates %zu of %zu bones.\n", lod, bones.count(), model->n_bones);
     }
-    for (auto node : ai_bone_ends) {
-        glm::mat4 transform = ai_to_glm_mat4(node->mTransformation);
-        model->bone_ends.push_back({
-            model->bone_mapping.at(node->mParent->mName.C_Str()),
-            glm::vec3{transform[3]}
-            });
-    } 
 }
 
 void ModelManager::process_mesh(
@@ -231,7 +349,7 @@ void ModelManager::process_mesh(
         std::vector<VertPNUBiBw>& vertices,
         std::vector<GLuint>& indices,
         const glm::mat4& transform,
-        const std::unordered_map<std::string, uint8_t>& bone_mapping,
+        const BoneNameTable& bone_names,
         aiMesh* ai_mesh
         )
 {
@@ -253,7 +371,8 @@ void ModelManager::process_mesh(
 
     for (size_t i = 0; i < ai_mesh->mNumBones; i++) {
         aiBone* bone = ai_mesh->mBones[i];
-        uint8_t bone_id = bone_mapping.at(bone->mName.C_Str());
+        uint8_t bone_id = bone_names.find(bone->mName.C_Str(), bone->mName.length);
+        if (bone_id == INVALID_BONE_ID) continue;
         for (size_t j = 0; j < bone->mNumWeights; j++) {
             aiVertexWeight weight = bone->mWeights[j];
             VertPNUBiBw& vert = vertices[mesh_offset + weight.mVertexId];
@@ -279,6 +398,11 @@ void ModelManager::process_mesh(
             vertex.bone_ids[0] = 0;
             vertex.bone_weights[0] = 1.f;
         }
+        for (size_t k = 0; k < 4; k++) {
+            if (vertex.bone_weights[k] > 0.f) {
+                mesh->bones.set(vertex.bone_ids[k]);
+            }
+        }
     }
 
     GLuint offset = indices.size();
@@ -293,115 +417,450 @@ void ModelManager::process_mesh(
     }
 
     mesh->material_h = ai_mesh->mMaterialIndex;
-    mesh->offset = offset;
-    mesh->count = count;
+    mesh->n_lods = 1;
+    mesh->lods[0] = {static_cast<GLsizei>(offset), static_cast<GLsizei>(count)};
+}
+
+void ModelManager::process_lods(Model* model, size_t n_lods)
+{
+    // Each level aims at half the triangle count of the previous one, all
+    // levels indexing into the shared vertex buffer. Levels that stop short
+    // of that (locked seams) could make the chain outgrow the space
+    // import_model reserves for it, so each mesh's chain is capped at the
+    // size of its full detail level and a level that would exceed it ends
+    // the chain.
+    std::vector<GLuint> source;
+    std::vector<GLuint> lod_indices;
+    for (size_t i = 0; i < model->n_meshes; i++) {
+        Mesh& mesh = model->meshes[i];
+        size_t n_chain_indices = 0;
+        while (mesh.n_lods < n_lods) {
+            const MeshLod& previous = mesh.lods[mesh.n_lods - 1];
+            source.assign(
+                model->indices.begin() + previous.offset,
+                model->indices.begin() + previous.offset + previous.count
+                );
+            size_t n_triangles = simplify_indices(lod_indices, model->vertices, source, source.size() / 6);
+            if (n_triangles == 0 or n_triangles * 3 >= source.size()) break;
+            if (n_chain_indices + lod_indices.size() > static_cast<size_t>(mesh.lods[0].count)) break;
+            n_chain_indices += lod_indices.size();
+            mesh.lods[mesh.n_lods++] = {
+                static_cast<GLsizei>(model->indices.size()),
+                static_cast<GLsizei>(lod_indices.size())
+                };
+            model->indices.insert(model->indices.end(), lod_indices.begin(), lod_indices.end());
+        }
+        printf("Mesh %zu has %zu LODs:", i, mesh.n_lods);
+        for (size_t j = 0; j < mesh.n_lods; j++) {
+            printf(" %d", mesh.lods[j].count / 3);
+        }
+        printf(" triangles.\n");
+    }
+}
+
+#if defined(__SSE2__)
+static inline __m128 transform_point(const glm::mat4& mat, __m128 point)
+{
+    const float* m = glm::value_ptr(mat);
+    __m128 x = _mm_shuffle_ps(point, point, _MM_SHUFFLE(0, 0, 0, 0));
+    __m128 y = _mm_shuffle_ps(point, point, _MM_SHUFFLE(1, 1, 1, 1));
+    __m128 z = _mm_shuffle_ps(point, point, _MM_SHUFFLE(2, 2, 2, 2));
+    return _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(m + 0), x), _mm_mul_ps(_mm_loadu_ps(m + 4), y)),
+        _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(m + 8), z), _mm_loadu_ps(m + 12))
+        );
+}
+
+static inline void merge_in(__m128& box_min, __m128& box_max, __m128 point)
+{
+    box_min = _mm_min_ps(box_min, point);
+    box_max = _mm_max_ps(box_max, point);
+}
+#endif
+
+void ModelManager::process_bounds(Model* model, const std::vector<VertPNUBiBw>& vertices, size_t max_threads)
+{
+    const size_t MIN_RANGE_SIZE = 4096;
+    auto start_time = std::chrono::steady_clock::now();
+
+    // Each bone's bounds cover the bind-space positions of the vertices it
+    // influences, so a skinning palette carries them straight to the posed
+    // mesh. Bones dropped by a skeleton LOD hand their vertices to the
+    // ancestor they are remapped to, so each level gets its own set of bounds.
+    std::vector<glm::mat4> global_pose (model->n_bones);
+    convert_local_to_global_pose({global_pose.data(), global_pose.size()}, model, model->default_pose, false);
+    size_t n_lods = model->n_skeleton_lods;
+
+    struct RangeBounds
+    {
+        BoundingBox bbox;
+        std::array<std::array<BoundingBox, MAX_BONES>, MAX_LODS> bone_boxes;
+    };
+    size_t n_ranges = parallel_range_count(vertices.size(), MIN_RANGE_SIZE, max_threads);
+    std::vector<RangeBounds> ranges (n_ranges);
+
+    parallel_for_ranges(vertices.size(), MIN_RANGE_SIZE, max_threads, [&](size_t range_id, size_t begin, size_t end) {
+        RangeBounds& range = ranges[range_id];
+#if defined(__SSE2__)
+        __m128 box_min = _mm_set1_ps(std::numeric_limits<float>::max());
+        __m128 box_max = _mm_set1_ps(-std::numeric_limits<float>::max());
+        __m128 bone_mins[MAX_LODS][MAX_BONES];
+        __m128 bone_maxs[MAX_LODS][MAX_BONES];
+        for (size_t lod = 0; lod < n_lods; lod++) {
+            for (size_t i = 0; i < MAX_BONES; i++) {
+                bone_mins[lod][i] = box_min;
+                bone_maxs[lod][i] = box_max;
+            }
+        }
+        for (size_t i = begin; i < end; i++) {
+            const VertPNUBiBw& vert = vertices[i];
+            __m128 position = _mm_setr_ps(vert.position.x, vert.position.y, vert.position.z, 1.f);
+            __m128 global_position = _mm_setzero_ps();
+            for (size_t j = 0; j < 4; j++) {
+                if (vert.bone_weights[j] <= 0.f) continue;
+                uint8_t bone_id = vert.bone_ids[j];
+                for (size_t lod = 0; lod < n_lods; lod++) {
+                    uint8_t lod_bone_id = model->skeleton_lod_remap[lod][bone_id];
+                    merge_in(bone_mins[lod][lod_bone_id], bone_maxs[lod][lod_bone_id], position);
+                }
+                __m128 bone_position = transform_point(model->offsets[bone_id], position);
+                global_position = _mm_add_ps(
+                    global_position,
+                    _mm_mul_ps(_mm_set1_ps(vert.bone_weights[j]), transform_point(global_pose[bone_id], bone_position))
+                    );
+            }
+            merge_in(box_min, box_max, global_position);
+        }
+        alignas(16) float out_min[4];
+        alignas(16) float out_max[4];
+        _mm_store_ps(out_min, box_min);
+        _mm_store_ps(out_max, box_max);
+        range.bbox = {glm::vec3{out_min[0], out_min[1], out_min[2]}, glm::vec3{out_max[0], out_max[1], out_max[2]}};
+        for (size_t lod = 0; lod < n_lods; lod++) {
+            for (size_t i = 0; i < model->n_bones; i++) {
+                _mm_store_ps(out_min, bone_mins[lod][i]);
+                _mm_store_ps(out_max, bone_maxs[lod][i]);
+                range.bone_boxes[lod][i] = {
+                    glm::vec3{out_min[0], out_min[1], out_min[2]},
+                    glm::vec3{out_max[0], out_max[1], out_max[2]}
+                    };
+            }
+        }
+#else
+        const BoundingBox empty = {glm::vec3{std::numeric_limits<float>::max()}, glm::vec3{-std::numeric_limits<float>::max()}};
+        range.bbox = empty;
+        for (size_t lod = 0; lod < n_lods; lod++) {
+            range.bone_boxes[lod].fill(empty);
+        }
+        for (size_t i = begin; i < end; i++) {
+            const VertPNUBiBw& vert = vertices[i];
+            glm::vec4 global_position {0.f, 0.f, 0.f, 0.f};
+            for (size_t j = 0; j < 4; j++) {
+                if (vert.bone_weights[j] <= 0.f) continue;
+                uint8_t bone_id = vert.bone_ids[j];
+                for (size_t lod = 0; lod < n_lods; lod++) {
+                    uint8_t lod_bone_id = model->skeleton_lod_remap[lod][bone_id];
+                    range.bone_boxes[lod][lod_bone_id].merge_in(vert.position);
+                }
+                glm::vec4 bone_position = model->offsets[bone_id] * glm::vec4{vert.position, 1.f};
+                global_position += vert.bone_weights[j] * (global_pose[bone_id] * bone_position);
+            }
+            range.bbox.merge_in(glm::vec3{global_position});
+        }
+#endif
+    });
+
+    for (const RangeBounds& range : ranges) {
+        model->bbox.merge_in(range.bbox.min);
+        model->bbox.merge_in(range.bbox.max);
+    }
+    for (size_t lod = 0; lod < n_lods; lod++) {
+        for (size_t i = 0; i < model->n_bones; i++) {
+            BoundingBox bone_box = ranges[0].bone_boxes[lod][i];
+            for (size_t j = 1; j < n_ranges; j++) {
+                bone_box.merge_in(ranges[j].bone_boxes[lod][i].min);
+                bone_box.merge_in(ranges[j].bone_boxes[lod][i].max);
+            }
+            BoneBounds& bounds = model->bone_bounds[lod][i];
+            if (bone_box.min.x > bone_box.max.x) {
+                bounds.center = glm::vec4{0.f, 0.f, 0.f, 1.f};
+                bounds.extent = glm::vec4{-1.f, -1.f, -1.f, 0.f};
+            } else {
+                bounds.center = glm::vec4{(bone_box.min + bone_box.max) / 2.f, 1.f};
+                bounds.extent = glm::vec4{(bone_box.max - bone_box.min) / 2.f, 0.f};
+            }
+        }
+    }
+
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start_time;
+    printf(
+        "Computed bounds of %zu vertices in %.3f ms (%zu ranges).\n",
+        vertices.size(), elapsed.count(), n_ranges
+        );
 }
 
 void ModelManager::process_material(Material* mat, aiMaterial* ai_mat, const std::string& base_dir)
 {
     aiString tex_path;
     ai_mat->GetTexture(aiTextureType_DIFFUSE, 0, &tex_path, nullptr, nullptr, nullptr, nullptr, nullptr);
-    std::string full_path = base_dir + "/" + tex_path.C_Str();
-    mat->diffuse_tex = il_->make_texture_from_image(full_path.c_str());
+    mat->diffuse_path = base_dir + "/" + tex_path.C_Str();
+    mat->diffuse_tex = 0;
+}
+
+static float key_distance(const glm::vec3& lhs, const glm::vec3& rhs)
+{
+    glm::vec3 diff = glm::abs(lhs - rhs);
+    return std::max(diff.x, std::max(diff.y, diff.z));
+}
+
+// Angle of the rotation between the two, in radians. Computed from the
+// vector part of the difference rather than acos of the dot product, which
+// cannot resolve angles below about a milliradian in float.
+static float key_distance(const glm::quat& lhs, const glm::quat& rhs)
+{
+    glm::quat delta = glm::conjugate(lhs) * rhs;
+    float sin_half_angle = glm::length(glm::vec3{delta.x, delta.y, delta.z});
+    return 2.f * std::atan2(sin_half_angle, std::abs(delta.w));
 }
 
-bool ModelManager::load_model(Model* model, Animation* animation, const char* path)
+// Reduces a track whose keys all hold the same value to that one key, or to
+// no keys if the value matches the rest pose. Returns the number of keys
+// removed.
+template <typename T>
+static size_t collapse_constant_track(std::vector<Key<T>>& keys, const T& rest_value)
+{
+    // Units for positions and scales, radians for rotations.
+    const float EPSILON = 1e-5f;
+    size_t n_keys = keys.size();
+    if (n_keys == 0) {
+        return 0;
+    }
+    for (const Key<T>& key : keys) {
+        if (key_distance(key.value, keys.front().value) > EPSILON) {
+            return 0;
+        }
+    }
+    if (key_distance(keys.front().value, rest_value) <= EPSILON) {
+        keys.clear();
+    } else {
+        keys.resize(1);
+    }
+    return n_keys - keys.size();
+}
+
+void ModelManager::process_animation(
+        Animation* animation,
+        const Model* model,
+        const aiAnimation* ai_animation,
+        bool reduce_keys
+        )
+{
+    auto start_time = std::chrono::steady_clock::now();
+    size_t n_removed_channels = 0;
+    size_t n_removed_keys = 0;
+    size_t n_keys = 0;
+    animation->duration = ai_animation->mDuration;
+    for (size_t i = 0; i < ai_animation->mNumChannels; i++) {
+        const aiNodeAnim* node_anim = ai_animation->mChannels[i];
+        size_t n_channel_keys = (
+            node_anim->mNumPositionKeys + node_anim->mNumRotationKeys + node_anim->mNumScalingKeys
+            );
+        n_keys += n_channel_keys;
+        uint8_t bone_id = model->bone_names.find(node_anim->mNodeName.C_Str(), node_anim->mNodeName.length);
+        if (bone_id == INVALID_BONE_ID) {
+            n_removed_channels++;
+            n_removed_keys += n_channel_keys;
+            continue;
+        }
+        Channel& channel = animation->channels[animation->n_channels];
+        channel.bone_id = bone_id;
+        channel.position_keys.clear();
+        channel.rotation_keys.clear();
+        channel.scale_keys.clear();
+        channel.position_keys.reserve(node_anim->mNumPositionKeys);
+        channel.rotation_keys.reserve(node_anim->mNumRotationKeys);
+        channel.scale_keys.reserve(node_anim->mNumScalingKeys);
+        for (size_t j = 0; j < node_anim->mNumPositionKeys; j++) {
+            channel.position_keys.push_back({
+                static_cast<float>(node_anim->mPositionKeys[j].mTime),
+                ai_to_glm_vec3(node_anim->mPositionKeys[j].mValue)
+                });
+        }
+        for (size_t j = 0; j < node_anim->mNumRotationKeys; j++) {
+            channel.rotation_keys.push_back({
+                static_cast<float>(node_anim->mRotationKeys[j].mTime),
+                ai_to_glm_quat(node_anim->mRotationKeys[j].mValue)
+                });
+        }
+        for (size_t j = 0; j < node_anim->mNumScalingKeys; j++) {
+            channel.scale_keys.push_back({
+                static_cast<float>(node_anim->mScalingKeys[j].mTime),
+                ai_to_glm_vec3(node_anim->mScalingKeys[j].mValue)
+                });
+        }
+        if (reduce_keys) {
+            const LocalPose& rest_pose = model->default_pose;
+            n_removed_keys += collapse_constant_track(channel.position_keys, rest_pose.positions[channel.bone_id]);
+            n_removed_keys += collapse_constant_track(channel.rotation_keys, rest_pose.rotations[channel.bone_id]);
+            n_removed_keys += collapse_constant_track(channel.scale_keys, rest_pose.scales[channel.bone_id]);
+            if (channel.position_keys.empty() and channel.rotation_keys.empty() and channel.scale_keys.empty()) {
+                n_removed_channels++;
+                continue;
+            }
+        }
+        animation->n_channels++;
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start_time;
+    printf(
+        "Removed %zu of %u channels and %zu of %zu keys in %.3f ms.\n",
+        n_removed_channels, ai_animation->mNumChannels, n_removed_keys, n_keys, elapsed.count()
+        );
+}
+
+bool ModelManager::import_model(
+        Model* model,
+        Animation* animation,
+        const char* path,
+        ImportProfile profile,
+        size_t max_threads,
+        std::vector<std::string>* source_paths
+        )
 {
     std::string s_path (path);
     std::string base_dir = s_path.substr(0, s_path.find_last_of('/'));
+    const ImportSettings& settings = get_import_settings(profile);
     
-    const aiScene* scene = importer_.ReadFile(path, aiProcess_Triangulate);
+    auto parse_start_time = std::chrono::steady_clock::now();
+    SceneHandle handle = importers_.read_file(path, settings.post_process_flags);
+    const aiScene* scene = handle.get_scene();
     if (scene == nullptr) {
         fprintf(stderr, "Failed to load model \"%s\".\n", path);
         return false;
     }
+    std::chrono::duration<double, std::milli> parse_elapsed = std::chrono::steady_clock::now() - parse_start_time;
+    printf(
+        "Parsed \"%s\" in %.3f ms, peak RSS %.1f MiB.\n",
+        path, parse_elapsed.count(), get_peak_rss() / (1024.0 * 1024.0)
+        );
+    if (source_paths) {
+        *source_paths = handle.get_requested_paths();
+    }
 
-    for (size_t i = 0; i < scene->mNumMaterials; i++) {
+    auto start_time = std::chrono::steady_clock::now();
+    HeapCounts& heap_counts = get_heap_counts();
+    size_t start_allocations = heap_counts.n_allocations;
+    ptrdiff_t start_live_bytes = heap_counts.live_bytes;
+    heap_counts.peak_live_bytes = heap_counts.live_bytes;
+    SceneSizes sizes;
+    measure_scene(sizes, scene, scene->mRootNode);
+    // Room for the bone offsets, the flattened node table and the mesh
+    // traversal stack, plus alignment padding for each allocation.
+    LinearArena arena {
+        sizeof(BoneOffset) * sizes.n_bone_refs +
+        sizes.n_nodes * (sizeof(SceneNode) + sizeof(NodeTransform)) +
+        3 * alignof(std::max_align_t)
+    };
+
+    model->n_materials = std::min<size_t>(scene->mNumMaterials, MAX_MESHES);
+    for (size_t i = 0; i < model->n_materials; i++) {
         process_material(&model->materials[i], scene->mMaterials[i], base_dir);
     }
 
-    process_bones(model, scene);
+    auto bones_start_time = std::chrono::steady_clock::now();
+    if (not process_bones(model, scene, sizes, arena)) {
+        return false;
+    }
+    std::chrono::duration<double, std::milli> bones_elapsed = std::chrono::steady_clock::now() - bones_start_time;
+    printf(
+        "Built %zu bones from %zu nodes in %.3f ms.\n",
+        model->n_bones - 1, sizes.n_nodes, bones_elapsed.count()
+        );
+    process_skeleton_lods(model);
 
-    std::vector<VertPNUBiBw> vertices;
-    std::vector<GLuint> indices;
+    // process_lods caps each mesh's LOD chain at the size of the mesh, so
+    // the whole chain fits in twice the source indices.
+    std::vector<VertPNUBiBw>& vertices = model->vertices;
+    std::vector<GLuint>& indices = model->indices;
+    vertices.reserve(sizes.n_vertices);
+    indices.reserve(2 * sizes.n_indices);
 
-    std::stack<std::pair<glm::mat4, aiNode*>> to_explore;
-    to_explore.push({glm::mat4{1.f}, scene->mRootNode});
-    while (not to_explore.empty()) {
-        glm::mat4 transform;
-        aiNode* node;
-        std::tie(transform, node) = to_explore.top();
-        to_explore.pop();
-        glm::mat4 full_transform = transform * ai_to_glm_mat4(node->mTransformation);
+    NodeTransform* to_explore = arena.allocate<NodeTransform>(sizes.n_nodes);
+    size_t n_to_explore = 0;
+    to_explore[n_to_explore++] = {glm::mat4{1.f}, scene->mRootNode};
+    while (n_to_explore > 0) {
+        NodeTransform top = to_explore[--n_to_explore];
+        aiNode* node = top.node;
+        glm::mat4 full_transform = top.transform * ai_to_glm_mat4(node->mTransformation);
         for (size_t i = 0; i < node->mNumMeshes; i++) {
             Mesh* mesh = &model->meshes[model->n_meshes++];
             aiMesh* ai_mesh = scene->mMeshes[node->mMeshes[i]];
-            process_mesh(mesh, vertices, indices, full_transform, model->bone_mapping, ai_mesh);
+            process_mesh(mesh, vertices, indices, full_transform, model->bone_names, ai_mesh);
         }
         for (size_t i = 0; i < node->mNumChildren; i++) {
-            to_explore.push({full_transform, node->mChildren[i]});
+            to_explore[n_to_explore++] = {full_transform, node->mChildren[i]};
         }
     }
 
-    Pose global_pose;
-    convert_local_to_global_pose(global_pose, model, model->default_pose, true);
-    for (size_t i = 0; i < vertices.size(); i++) {
-        const VertPNUBiBw& vert = vertices[i];
-        glm::mat4 model_transform = (
-            vert.bone_weights[0] * global_pose[vert.bone_ids[0]] + 
-            vert.bone_weights[1] * global_pose[vert.bone_ids[1]] + 
-            vert.bone_weights[2] * global_pose[vert.bone_ids[2]] + 
-            vert.bone_weights[3] * global_pose[vert.bone_ids[3]]
-            );
-        glm::vec3 global_position = glm::vec3(model_transform * glm::vec4{vertices[i].position, 1.f});
-        model->bbox.merge_in(global_position);
-    }
-
-    glGenVertexArrays(1, &model->vao);
-    glGenBuffers(1, &model->vbo);
-    glGenBuffers(1, &model->ebo);
-    glBindVertexArray(model->vao);
-    glBindBuffer(GL_ARRAY_BUFFER, model->vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(VertPNUBiBw) * vertices.size(), vertices.data(), GL_STATIC_DRAW);
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-    glEnableVertexAttribArray(2);
-    glEnableVertexAttribArray(3);
-    glEnableVertexAttribArray(4);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(VertPNUBiBw), reinterpret_cast<GLvoid*>(offsetof(VertPNUBiBw, position)));
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_TRUE, sizeof(VertPNUBiBw), reinterpret_cast<GLvoid*>(offsetof(VertPNUBiBw, normal)));
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(VertPNUBiBw), reinterpret_cast<GLvoid*>(offsetof(VertPNUBiBw, tex_coord)));
-    glVertexAttribIPointer(3, 4, GL_INT, sizeof(VertPNUBiBw), reinterpret_cast<GLvoid*>(offsetof(VertPNUBiBw, bone_ids)));
-    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(VertPNUBiBw), reinterpret_cast<GLvoid*>(offsetof(VertPNUBiBw, bone_weights)));
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model->ebo); 
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * indices.size(), indices.data(), GL_STATIC_READ);
+    process_lods(model, std::min(settings.n_mesh_lods, MAX_LODS));
+    process_bounds(model, vertices, max_threads);
 
     if (scene->mNumAnimations > 0) {
-        aiAnimation* ai_animation = scene->mAnimations[0];
-        animation->duration = ai_animation->mDuration;
-        for (size_t i = 0; i < ai_animation->mNumChannels; i++) {
-            aiNodeAnim* node_anim = ai_animation->mChannels[i];
-            Channel& channel = animation->channels[animation->n_channels++];
-            if (model->bone_mapping.count(node_anim->mNodeName.C_Str())) {
-                channel.bone_id = model->bone_mapping.at(node_anim->mNodeName.C_Str());
-                for (size_t j = 0; j < node_anim->mNumPositionKeys; j++) {
-                    channel.position_keys.push_back({
-                        static_cast<float>(node_anim->mPositionKeys[j].mTime),
-                        ai_to_glm_vec3(node_anim->mPositionKeys[j].mValue)
-                        });
-                }
-                for (size_t j = 0; j < node_anim->mNumRotationKeys; j++) {
-                    channel.rotation_keys.push_back({
-                        static_cast<float>(node_anim->mRotationKeys[j].mTime),
-                        ai_to_glm_quat(node_anim->mRotationKeys[j].mValue)
-                        });
-                }
-            }
-        }
+        process_animation(animation, model, scene->mAnimations[0], settings.reduce_keys);
+    }
+
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start_time;
+    printf(
+        "Imported \"%s\" in %.3f ms using %zu of %zu arena bytes.\n",
+        path, elapsed.count(), arena.get_used(), arena.get_capacity()
+        );
+    if (is_counting_heap()) {
+        printf(
+            "Imported \"%s\" with %zu heap allocations, peaking at %.1f KiB live.\n",
+            path, heap_counts.n_allocations - start_allocations,
+            (heap_counts.peak_live_bytes - start_live_bytes) / 1024.0
+            );
     }
+    size_t n_keys = 0;
+    for (size_t i = 0; i < animation->n_channels; i++) {
+        const Channel& channel = animation->channels[i];
+        n_keys += channel.position_keys.size() + channel.rotation_keys.size() + channel.scale_keys.size();
+    }
+    size_t n_mesh_bytes = sizeof(VertPNUBiBw) * vertices.size() + sizeof(GLuint) * indices.size();
+    std::chrono::duration<double, std::milli> total_elapsed = std::chrono::steady_clock::now() - parse_start_time;
+    printf(
+        "Profile \"%s\" imported \"%s\" in %.3f ms: %zu meshes, %zu vertices, %zu indices (%.1f KiB), %zu animation keys.\n",
+        settings.name, path, total_elapsed.count(), model->n_meshes, vertices.size(), indices.size(),
+        n_mesh_bytes / 1024.0, n_keys
+        );
     return true;
 }
 
+bool ModelManager::import_models(
+        Model* const* models,
+        Animation* const* animations,
+        const char* const* paths,
+        size_t n_models,
+        ImportProfile profile,
+        bool* is_imported
+        )
+{
+    auto start_time = std::chrono::steady_clock::now();
+    std::atomic<size_t> n_failed {0};
+    // More workers than importers would only block in read_file.
+    size_t n_workers = parallel_for_each(n_models, importers_.size(), [&](size_t i, size_t max_import_threads) {
+        bool ok = import_model(models[i], animations[i], paths[i], profile, max_import_threads);
+        if (is_imported) {
+            is_imported[i] = ok;
+        }
+        if (not ok) {
+            n_failed++;
+        }
+    });
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start_time;
+    printf("Imported %zu models on %zu threads in %.3f ms.\n", n_models, n_workers, elapsed.count());
+    return n_failed == 0;
+}
+
 template <typename T>
 static T get_key_value(const std::vector<Key<T>>& keys, float time)
 {
@@ -428,105 +887,399 @@ static T get_key_value(const std::vector<Key<T>>& keys, float time)
     return glm::mix(keys[bbegin].value, keys[bbegin + 1].value, interp);
 }
 
-void ModelManager::update_pose(Model* model, Pose& pose, Animation* animation, float time)
+void ModelManager::compute_required_bones(
+        BoneSet& required,
+        const Model* model,
+        const MeshSet& visible_meshes,
+        const uint8_t* query_bones,
+        size_t n_query_bones
+        )
+{
+    required.reset();
+    for (size_t i = 0; i < model->n_meshes; i++) {
+        if (visible_meshes.test(i)) {
+            required |= model->meshes[i].bones;
+        }
+    }
+    for (size_t i = 0; i < n_query_bones; i++) {
+        required.set(query_bones[i]);
+    }
+    // Parents precede children, so one backwards pass reaches every ancestor.
+    for (size_t i = model->n_bones; i-- > 0;) {
+        if (required.test(i) and model->parent_ids[i] < model->n_bones) {
+            required.set(model->parent_ids[i]);
+        }
+    }
+}
+
+void ModelManager::update_pose(
+        Model* model,
+        LocalPose& pose,
+        Animation* animation,
+        float time,
+        size_t lod,
+        const BoneSet* bone_mask
+        )
 {
-    time *= 24.f;
+    time *= ANIMATION_TICKS_PER_SECOND;
     float looped_time = time - glm::floor(time / animation->duration) * animation->duration;
-    for (size_t i = 0; i < model->n_bones; i++) {
-        pose[i] = model->default_pose[i];
-    } 
+    BoneSet bones = model->skeleton_lod_bones[std::min(lod, model->n_skeleton_lods - 1)];
+    if (bone_mask) {
+        bones &= *bone_mask;
+    }
+    const LocalPose& default_pose = model->default_pose;
+    std::copy_n(default_pose.positions.begin(), model->n_bones, pose.positions.begin());
+    std::copy_n(default_pose.rotations.begin(), model->n_bones, pose.rotations.begin());
+    std::copy_n(default_pose.scales.begin(), model->n_bones, pose.scales.begin());
     for (size_t i = 0 ; i < animation->n_channels; i++) {
         Channel& channel = animation->channels[i];
-        PosRotScale prs = model->default_pose_prs[channel.bone_id];
+        if (not bones.test(channel.bone_id)) continue;
         if (not channel.position_keys.empty()) {
-            prs.position = get_key_value(channel.position_keys, looped_time);
+            pose.positions[channel.bone_id] = get_key_value(channel.position_keys, looped_time);
         }
-        if (not channel.position_keys.empty()) {
-            prs.rotation = get_key_value(channel.rotation_keys, looped_time);
+        if (not channel.rotation_keys.empty()) {
+            pose.rotations[channel.bone_id] = get_key_value(channel.rotation_keys, looped_time);
+        }
+        if (not channel.scale_keys.empty()) {
+            pose.scales[channel.bone_id] = get_key_value(channel.scale_keys, looped_time);
         }
-        pose[channel.bone_id] = prs.to_mat4();
     }
 }
 
-void ModelManager::draw_model(
+void ModelManager::blend_pose(
         Model* model,
-        const Pose& pose,
-        const glm::mat4& projection,
-        const glm::mat4& view
+        LocalPose& pose,
+        const BlendLayer* layers,
+        size_t n_layers,
+        size_t lod
         )
 {
-    Pose global_pose;
-    convert_local_to_global_pose(global_pose, model, pose, true);
+    PoseAccumulator acc;
+    LocalPose layer_pose;
+    clear_pose_accumulator(acc, model->n_bones);
+    for (size_t i = 0; i < n_layers; i++) {
+        const BlendLayer& layer = layers[i];
+        if (layer.weight <= 0.f) continue;
+        // Bones the mask zeroes out carry no weight, so their channels are
+        // not sampled at all.
+        BoneSet layer_bones;
+        const BoneSet* bone_mask = nullptr;
+        if (layer.mask) {
+            for (size_t j = 0; j < model->n_bones; j++) {
+                layer_bones[j] = (*layer.mask)[j] > 0.f;
+            }
+            bone_mask = &layer_bones;
+        }
+        update_pose(model, layer_pose, layer.animation, layer.time, lod, bone_mask);
+        accumulate_pose(acc, layer_pose, layer.weight, layer.mask, model->n_bones);
+    }
+    resolve_pose(pose, acc, model->default_pose, model->n_bones);
+}
 
-    glUseProgram(program_);
-    glBindVertexArray(model->vao);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model->ebo);
-    glUniformMatrix4fv(loc_projection_, 1, GL_FALSE, glm::value_ptr(projection));
-    glUniformMatrix4fv(loc_view_, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(loc_pose_, model->n_bones, GL_FALSE, reinterpret_cast<const GLfloat*>(global_pose.data()));
-    glActiveTexture(GL_TEXTURE1);
-    for (size_t i = 0; i < model->n_meshes; i++) {
-        const Mesh& mesh = model->meshes[i];
-        glBindTexture(GL_TEXTURE_2D, model->materials[mesh.material_h].diffuse_tex);
-        glUniform1i(loc_diffuse_tex_, 1);
-        glDrawElements(GL_TRIANGLES, mesh.count, GL_UNSIGNED_INT, reinterpret_cast<GLvoid*>(sizeof(GLuint) * mesh.offset));
+bool ModelManager::make_additive(Animation* animation, const Model* model)
+{
+    if (animation->is_additive) {
+        fprintf(stderr, "Failed to make animation additive, it already is\n");
+        return false;
+    }
+    const LocalPose& reference = model->default_pose;
+    for (size_t i = 0; i < animation->n_channels; i++) {
+        Channel& channel = animation->channels[i];
+        for (Key<glm::vec3>& key : channel.position_keys) {
+            key.value -= reference.positions[channel.bone_id];
+        }
+        // Deltas keep the hemisphere of the key before them, so keys
+        // interpolate along the same arc as the source clip's; apply_additive
+        // flips the sampled delta instead.
+        glm::quat inv_reference = glm::inverse(reference.rotations[channel.bone_id]);
+        glm::quat previous {1.f, 0.f, 0.f, 0.f};
+        for (Key<glm::quat>& key : channel.rotation_keys) {
+            glm::quat delta = inv_reference * key.value;
+            key.value = glm::dot(previous, delta) < 0.f ? -delta : delta;
+            previous = key.value;
+        }
+        for (Key<glm::vec3>& key : channel.scale_keys) {
+            key.value /= reference.scales[channel.bone_id];
+        }
     }
+    animation->is_additive = true;
+    return true;
 }
 
-void ModelManager::draw_skeleton(
+void ModelManager::apply_additive(
         Model* model,
-        const Pose& pose,
-        const glm::mat4& projection,
-        const glm::mat4& view
+        LocalPose& pose,
+        Animation* animation,
+        float time,
+        float weight,
+        size_t lod
         )
 {
-    glDisable(GL_DEPTH_TEST);
-    Pose global_pose;
-    convert_local_to_global_pose(global_pose, model, pose, false);
-    std::vector<VertPC> vertices;
-    size_t color_id = 0;
-    for (size_t i = 0; i < model->n_bones; i++) {
-        if (model->parent_ids[i] < model->n_bones) {
-            glm::vec3 color = bone_colors_[color_id++ % bone_colors_.size()];
-            vertices.push_back({
-                glm::vec3{global_pose[i] * glm::vec4{0.f, 0.f, 0.f, 1.f}},
-                color
-                });
-            vertices.push_back({
-                glm::vec3{global_pose[model->parent_ids[i]] *
-                glm::vec4{0.f, 0.f, 0.f, 1.f}},
-                color
-                });
+    time *= ANIMATION_TICKS_PER_SECOND;
+    float looped_time = time - glm::floor(time / animation->duration) * animation->duration;
+    const BoneSet& bones = model->skeleton_lod_bones[std::min(lod, model->n_skeleton_lods - 1)];
+    const glm::quat identity {1.f, 0.f, 0.f, 0.f};
+    for (size_t i = 0; i < animation->n_channels; i++) {
+        Channel& channel = animation->channels[i];
+        if (not bones.test(channel.bone_id)) continue;
+        if (not channel.position_keys.empty()) {
+            pose.positions[channel.bone_id] += weight * get_key_value(channel.position_keys, looped_time);
+        }
+        if (not channel.rotation_keys.empty()) {
+            glm::quat delta = get_key_value(channel.rotation_keys, looped_time);
+            if (delta.w < 0.f) {
+                delta = -delta;
+            }
+            delta = glm::normalize(identity * (1.f - weight) + delta * weight);
+            pose.rotations[channel.bone_id] = pose.rotations[channel.bone_id] * delta;
+        }
+        if (not channel.scale_keys.empty()) {
+            glm::vec3 factor = get_key_value(channel.scale_keys, looped_time);
+            pose.scales[channel.bone_id] *= glm::mix(glm::vec3{1.f, 1.f, 1.f}, factor, weight);
         }
     }
-    for (auto bone_end : model->bone_ends) {
-        glm::vec3 color = bone_colors_[color_id++ % bone_colors_.size()];
-        vertices.push_back({
-            glm::vec3{global_pose[bone_end.first] * glm::vec4{0.f, 0.f, 0.f, 1.f}},
-            color
-            });
-        vertices.push_back({
-            glm::vec3{global_pose[bone_end.first] * glm::vec4{bone_end.second, 1.f}},
-            color
-            });
+}
+
+size_t ModelManager::select_lod(const Model* model, const glm::mat4& projection, const glm::mat4& view)
+{
+    // Screen heights, as a fraction of the viewport, below which each
+    // successive LOD is used.
+    static const float LOD_SCREEN_SIZES[MAX_LODS - 1] = {0.25f, 0.125f, 0.0625f};
+
+    glm::vec3 center = (model->bbox.min + model->bbox.max) / 2.f;
+    float radius = glm::length(model->bbox.max - model->bbox.min) / 2.f;
+    float depth = -glm::vec3{view * glm::vec4{center, 1.f}}.z;
+    if (depth <= radius) return 0;
+    float screen_size = radius * projection[1][1] / depth;
+    size_t lod = 0;
+    while (lod < MAX_LODS - 1 and screen_size < LOD_SCREEN_SIZES[lod]) {
+        lod++;
+    }
+    return lod;
+}
+
+void ModelManager::bake_vertex_animation(
+        VertexAnimation* vat,
+        Skinner* skinner,
+        Model* model,
+        Animation* animation,
+        float frame_rate
+        )
+{
+    float duration = animation->duration / ANIMATION_TICKS_PER_SECOND;
+    size_t n_frames = std::max<size_t>(1, static_cast<size_t>(glm::round(duration * frame_rate)));
+    size_t n_vertices = model->vertices.size();
+
+    SkinningStream stream;
+    skinner->make_stream(stream, model);
+    std::vector<SkinnedVertices> frames (n_frames);
+    LocalPose local_pose;
+    Pose palette;
+    BoundingBox bounds {glm::vec3{std::numeric_limits<float>::max()}, glm::vec3{-std::numeric_limits<float>::max()}};
+    for (size_t i = 0; i < n_frames; i++) {
+        update_pose(model, local_pose, animation, duration * i / n_frames);
+        convert_local_to_global_pose(palette, model, local_pose, true);
+        skinner->skin(frames[i], stream, palette);
+        for (size_t j = 0; j < n_vertices; j++) {
+            bounds.merge_in(frames[i].position(j));
+        }
+    }
+
+    glm::vec3 bounds_size = glm::max(bounds.max - bounds.min, glm::vec3{1e-6f});
+    vat->n_vertices = n_vertices;
+    vat->n_frames = n_frames;
+    vat->duration = duration;
+    vat->bounds = bounds;
+    vat->positions.resize(4 * n_vertices * n_frames);
+    vat->normals.resize(4 * n_vertices * n_frames);
+    for (size_t i = 0; i < n_frames; i++) {
+        for (size_t j = 0; j < n_vertices; j++) {
+            size_t texel = 4 * (i * n_vertices + j);
+            glm::vec3 position = (frames[i].position(j) - bounds.min) / bounds_size;
+            glm::vec3 normal = frames[i].normal(j);
+            for (size_t k = 0; k < 3; k++) {
+                vat->positions[texel + k] = static_cast<uint16_t>(glm::round(glm::clamp(position[k], 0.f, 1.f) * 65535.f));
+                vat->normals[texel + k] = static_cast<int8_t>(glm::round(glm::clamp(normal[k], -1.f, 1.f) * 127.f));
+            }
+            vat->positions[texel + 3] = 0;
+            vat->normals[texel + 3] = 0;
+        }
     }
-    glPointSize(5.f);
-    du_->draw(GL_LINES, projection, view, vertices);
-    du_->draw(GL_POINTS, projection, view, vertices);
+    printf(
+        "Baked %zu frames of %zu vertices (%zu KB).\n",
+        n_frames, n_vertices,
+        (vat->positions.size() * sizeof(uint16_t) + vat->normals.size()) / 1024
+        );
 }
 
-void ModelManager::convert_local_to_global_pose(Pose& global_pose, const Model* model, const Pose& local_pose, bool apply_offsets)
+// Composes into a stack buffer of which only the first n_bones entries are
+// touched, and writes palette entries (with offsets if requested) in the
+// same pass.
+static void compose_pose(
+        PoseView out,
+        const Model* model,
+        const LocalPose& local_pose,
+        bool apply_offsets,
+        const BoneSet& bones,
+        const BoneSet& lod_bones,
+        const std::array<uint8_t, MAX_BONES>& remap
+        )
 {
+    glm::mat4 global[MAX_BONES];
     for (size_t i = 0; i < model->n_bones; i++) {
+        if (not bones.test(i)) continue;
+        glm::mat4 local_transform = local_pose.to_mat4(i);
         if (model->parent_ids[i] < model->n_bones) {
-            global_pose[i] = global_pose[model->parent_ids[i]] * local_pose[i];
+            global[i] = global[model->parent_ids[i]] * local_transform;
         } else {
-            global_pose[i] = local_pose[i];
+            global[i] = local_transform;
         }
+        out[i] = apply_offsets ? global[i] * model->offsets[i] : global[i];
     }
-    if (apply_offsets) {
-        for (size_t i = 0; i < model->n_bones; i++) {
-            global_pose[i] = global_pose[i] * model->offsets[i];
+    // Dropped bones alias their evaluated ancestor, which is equivalent to
+    // remapping their vertex weights onto it. Masked out bones influence
+    // nothing drawn and just alias their parent so the pose stays defined.
+    for (size_t i = 0; i < model->n_bones; i++) {
+        if (not lod_bones.test(i)) {
+            out[i] = out[remap[i]];
+        } else if (not bones.test(i)) {
+            uint8_t parent_id = model->parent_ids[i];
+            out[i] = parent_id < model->n_bones ? out[parent_id] : glm::mat4{1.f};
+        }
+    }
+}
+
+void ModelManager::convert_local_to_global_pose(
+        PoseView global_pose,
+        const Model* model,
+        const LocalPose& local_pose,
+        bool apply_offsets,
+        size_t lod,
+        const BoneSet* bone_mask
+        )
+{
+    lod = std::min(lod, model->n_skeleton_lods - 1);
+    const BoneSet& lod_bones = model->skeleton_lod_bones[lod];
+    const std::array<uint8_t, MAX_BONES>& remap = model->skeleton_lod_remap[lod];
+    BoneSet bones = lod_bones;
+    if (bone_mask) {
+        bones &= *bone_mask;
+    }
+    compose_pose(global_pose, model, local_pose, apply_offsets, bones, lod_bones, remap);
+}
+
+void ModelManager::set_local_pose(PoseState* state, const Model* model, const LocalPose& local_pose)
+{
+    LocalPose& current = state->local_pose;
+    for (size_t i = 0; i < model->n_bones; i++) {
+        if (
+            current.positions[i] != local_pose.positions[i] or
+            current.rotations[i] != local_pose.rotations[i] or
+            current.scales[i] != local_pose.scales[i]
+            ) {
+            current.positions[i] = local_pose.positions[i];
+            current.rotations[i] = local_pose.rotations[i];
+            current.scales[i] = local_pose.scales[i];
+            state->dirty.set(i);
         }
     }
 }
+
+void ModelManager::update_global_pose(PoseState* state, const Model* model, size_t lod, const BoneSet* bone_mask)
+{
+    lod = std::min(lod, model->n_skeleton_lods - 1);
+    bool has_mask = bone_mask != nullptr;
+    if (lod != state->lod or has_mask != state->has_mask or (has_mask and *bone_mask != state->mask)) {
+        state->lod = lod;
+        state->has_mask = has_mask;
+        state->mask = has_mask ? *bone_mask : BoneSet{};
+        state->dirty.set();
+    }
+    const BoneSet& lod_bones = model->skeleton_lod_bones[lod];
+    const std::array<uint8_t, MAX_BONES>& remap = model->skeleton_lod_remap[lod];
+    // Parents precede children, so a bone's dirty bit is final by the time
+    // its children inherit it. Skipped bones alias an ancestor the same way
+    // convert_local_to_global_pose does, and that ancestor comes first too.
+    for (size_t i = 0; i < model->n_bones; i++) {
+        uint8_t parent_id = model->parent_ids[i];
+        bool has_parent = parent_id < model->n_bones;
+        if (has_parent and state->dirty.test(parent_id)) {
+            state->dirty.set(i);
+        }
+        if (not state->dirty.test(i)) continue;
+        if (not lod_bones.test(i)) {
+            state->global_pose[i] = state->global_pose[remap[i]];
+            state->palette[i] = state->palette[remap[i]];
+        } else if (has_mask and not state->mask.test(i)) {
+            state->global_pose[i] = has_parent ? state->global_pose[parent_id] : glm::mat4{1.f};
+            state->palette[i] = has_parent ? state->palette[parent_id] : glm::mat4{1.f};
+        } else {
+            glm::mat4 local_transform = state->local_pose.to_mat4(i);
+            if (has_parent) {
+                state->global_pose[i] = state->global_pose[parent_id] * local_transform;
+            } else {
+                state->global_pose[i] = local_transform;
+            }
+            state->palette[i] = state->global_pose[i] * model->offsets[i];
+        }
+    }
+    state->palette_dirty |= state->dirty;
+    state->dirty.reset();
+}
+
+void ModelManager::compute_pose_bbox(BoundingBox& bbox, const Model* model, ConstPoseView palette, size_t lod)
+{
+    const std::array<BoneBounds, MAX_BONES>& bone_bounds = model->bone_bounds[std::min(lod, model->n_skeleton_lods - 1)];
+    // Each bone's bind-space bounds are carried through its palette entry as
+    // a center/extent pair, so the result is conservative and costs O(bones).
+#if defined(__SSE2__)
+    const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    __m128 box_min = _mm_set1_ps(std::numeric_limits<float>::max());
+    __m128 box_max = _mm_set1_ps(-std::numeric_limits<float>::max());
+    for (size_t i = 0; i < model->n_bones; i++) {
+        const BoneBounds& bounds = bone_bounds[i];
+        if (bounds.is_empty()) continue;
+        const float* mat = glm::value_ptr(palette[i]);
+        __m128 col0 = _mm_loadu_ps(mat + 0);
+        __m128 col1 = _mm_loadu_ps(mat + 4);
+        __m128 col2 = _mm_loadu_ps(mat + 8);
+        __m128 col3 = _mm_loadu_ps(mat + 12);
+        __m128 center = _mm_add_ps(
+            _mm_add_ps(
+                _mm_mul_ps(col0, _mm_set1_ps(bounds.center.x)),
+                _mm_mul_ps(col1, _mm_set1_ps(bounds.center.y))),
+            _mm_add_ps(
+                _mm_mul_ps(col2, _mm_set1_ps(bounds.center.z)),
+                col3));
+        __m128 extent = _mm_add_ps(
+            _mm_add_ps(
+                _mm_mul_ps(_mm_and_ps(col0, abs_mask), _mm_set1_ps(bounds.extent.x)),
+                _mm_mul_ps(_mm_and_ps(col1, abs_mask), _mm_set1_ps(bounds.extent.y))),
+            _mm_mul_ps(_mm_and_ps(col2, abs_mask), _mm_set1_ps(bounds.extent.z)));
+        box_min = _mm_min_ps(box_min, _mm_sub_ps(center, extent));
+        box_max = _mm_max_ps(box_max, _mm_add_ps(center, extent));
+    }
+    alignas(16) float out_min[4];
+    alignas(16) float out_max[4];
+    _mm_store_ps(out_min, box_min);
+    _mm_store_ps(out_max, box_max);
+    bbox.min = glm::vec3{out_min[0], out_min[1], out_min[2]};
+    bbox.max = glm::vec3{out_max[0], out_max[1], out_max[2]};
+#else
+    bbox.min = glm::vec3{std::numeric_limits<float>::max()};
+    bbox.max = glm::vec3{-std::numeric_limits<float>::max()};
+    for (size_t i = 0; i < model->n_bones; i++) {
+        const BoneBounds& bounds = bone_bounds[i];
+        if (bounds.is_empty()) continue;
+        const glm::mat4& mat = palette[i];
+        glm::vec3 center = glm::vec3{mat * bounds.center};
+        glm::vec3 extent = (
+            glm::abs(glm::vec3{mat[0]}) * bounds.extent.x +
+            glm::abs(glm::vec3{mat[1]}) * bounds.extent.y +
+            glm::abs(glm::vec3{mat[2]}) * bounds.extent.z
+            );
+        bbox.merge_in(center - extent);
+        bbox.merge_in(center + extent);
+    }
+#endif
+}
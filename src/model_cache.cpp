@@ -0,0 +1,439 @@
+#include "model_cache.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+static const char MODEL_MAGIC[4] = {'M', 'D', 'L', '2'};
+static const char ANIMATION_MAGIC[4] = {'C', 'L', 'P', '1'};
+static const char TEXTURE_MAGIC[4] = {'T', 'E', 'X', '1'};
+// The largest side GL_MAX_TEXTURE_SIZE is commonly at.
+static const uint32_t MAX_TEXTURE_SIZE = 16384;
+
+namespace {
+
+// Sequential binary writer that remembers whether any write failed, so a
+// whole file can be written before checking once.
+class CacheWriter
+{
+public:
+    CacheWriter(FILE* file)
+      : file_ {file}
+    {
+    }
+
+    template <typename T>
+    void write(const T* data, size_t count)
+    {
+        ok_ = ok_ and fwrite(data, sizeof(T), count, file_) == count;
+    }
+
+    template <typename T>
+    void write(const T& value)
+    {
+        write(&value, 1);
+    }
+
+    void write_size(size_t size)
+    {
+        write(static_cast<uint64_t>(size));
+    }
+
+    void write_string(const char* string)
+    {
+        size_t length = strlen(string);
+        write_size(length);
+        write(string, length);
+    }
+
+    void write_bone_set(const BoneSet& bones)
+    {
+        uint8_t bytes[(MAX_BONES + 7) / 8] = {};
+        for (size_t i = 0; i < MAX_BONES; i++) {
+            bytes[i / 8] |= bones[i] << (i % 8);
+        }
+        write(bytes, sizeof(bytes));
+    }
+
+    bool is_ok() const
+    {
+        return ok_;
+    }
+
+private:
+    FILE* file_;
+    bool ok_ = true;
+};
+
+class CacheReader
+{
+public:
+    CacheReader(FILE* file)
+      : file_ {file}
+    {
+        if (fseek(file_, 0, SEEK_END) == 0) {
+            long size = ftell(file_);
+            n_remaining_bytes_ = size > 0 ? static_cast<size_t>(size) : 0;
+        }
+        ok_ = fseek(file_, 0, SEEK_SET) == 0;
+    }
+
+    template <typename T>
+    void read(T* data, size_t count)
+    {
+        ok_ = ok_ and count <= n_remaining_bytes_ / sizeof(T) and fread(data, sizeof(T), count, file_) == count;
+        n_remaining_bytes_ -= ok_ ? sizeof(T) * count : 0;
+    }
+
+    template <typename T>
+    void read(T& value)
+    {
+        read(&value, 1);
+    }
+
+    // Sizes beyond `max_size` mark the file as corrupt and read as zero.
+    size_t read_size(size_t max_size)
+    {
+        uint64_t size = 0;
+        read(size);
+        if (size > max_size) {
+            ok_ = false;
+        }
+        return ok_ ? static_cast<size_t>(size) : 0;
+    }
+
+    // A count of T that the rest of the file has room for, so corrupt
+    // counts are caught before anything is allocated for them.
+    template <typename T>
+    size_t read_count(size_t max_count)
+    {
+        return read_size(std::min(max_count, n_remaining_bytes_ / sizeof(T)));
+    }
+
+    void read_string(std::string& string)
+    {
+        string.resize(read_count<char>(UINT16_MAX));
+        read(&string[0], string.size());
+    }
+
+    void read_bone_set(BoneSet& bones)
+    {
+        uint8_t bytes[(MAX_BONES + 7) / 8];
+        read(bytes, sizeof(bytes));
+        for (size_t i = 0; i < MAX_BONES; i++) {
+            bones[i] = ok_ and (bytes[i / 8] >> (i % 8)) & 1;
+        }
+    }
+
+    size_t get_remaining_size() const
+    {
+        return n_remaining_bytes_;
+    }
+
+    bool is_ok() const
+    {
+        return ok_;
+    }
+
+private:
+    FILE* file_;
+    size_t n_remaining_bytes_ = 0;
+    bool ok_ = true;
+};
+
+}
+
+// Everything later code indexes with must be in range, so a stale or
+// damaged cache is rejected rather than read out of bounds.
+static bool is_model_valid(const Model* model)
+{
+    if (model->n_bones == 0 or model->n_skeleton_lods == 0) {
+        return false;
+    }
+    for (size_t i = 0; i < model->n_meshes; i++) {
+        const Mesh& mesh = model->meshes[i];
+        if (mesh.n_lods == 0 or mesh.material_h >= std::max<size_t>(model->n_materials, 1)) {
+            return false;
+        }
+        for (size_t j = 0; j < mesh.n_lods; j++) {
+            const MeshLod& lod = mesh.lods[j];
+            if (lod.offset < 0 or lod.count < 0 or static_cast<size_t>(lod.offset) + lod.count > model->indices.size()) {
+                return false;
+            }
+        }
+    }
+    for (GLuint index : model->indices) {
+        if (index >= model->vertices.size()) {
+            return false;
+        }
+    }
+    for (const VertPNUBiBw& vertex : model->vertices) {
+        for (size_t j = 0; j < 4; j++) {
+            if (vertex.bone_ids[j] < 0 or static_cast<size_t>(vertex.bone_ids[j]) >= model->n_bones) {
+                return false;
+            }
+        }
+    }
+    // Parents precede their children; roots have none.
+    for (size_t i = 0; i < model->n_bones; i++) {
+        uint8_t parent_id = model->parent_ids[i];
+        if (parent_id != UINT8_MAX and parent_id >= i) {
+            return false;
+        }
+    }
+    for (const auto& bone_end : model->bone_ends) {
+        if (bone_end.first >= model->n_bones) {
+            return false;
+        }
+    }
+    for (size_t lod = 0; lod < model->n_skeleton_lods; lod++) {
+        for (size_t i = 0; i < model->n_bones; i++) {
+            if (model->skeleton_lod_remap[lod][i] >= model->n_bones) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool write_model_cache(const Model* model, const char* path)
+{
+    FILE* file = fopen(path, "wb");
+    if (file == nullptr) {
+        fprintf(stderr, "Failed to open \"%s\" for writing.\n", path);
+        return false;
+    }
+    CacheWriter writer {file};
+    writer.write(MODEL_MAGIC, sizeof(MODEL_MAGIC));
+
+    writer.write_size(model->n_meshes);
+    for (size_t i = 0; i < model->n_meshes; i++) {
+        const Mesh& mesh = model->meshes[i];
+        writer.write(mesh.material_h);
+        writer.write_size(mesh.n_lods);
+        writer.write(mesh.lods.data(), mesh.n_lods);
+        writer.write_bone_set(mesh.bones);
+    }
+    writer.write_size(model->n_materials);
+    for (size_t i = 0; i < model->n_materials; i++) {
+        writer.write_string(model->materials[i].diffuse_path.c_str());
+    }
+    writer.write_size(model->vertices.size());
+    writer.write(model->vertices.data(), model->vertices.size());
+    writer.write_size(model->indices.size());
+    writer.write(model->indices.data(), model->indices.size());
+    writer.write(model->bbox);
+    writer.write(model->bone_bounds);
+
+    writer.write_size(model->n_bones);
+    for (size_t i = 0; i < model->n_bones; i++) {
+        writer.write_string(model->bone_names.get_name(i));
+    }
+    writer.write(model->parent_ids.data(), model->n_bones);
+    writer.write_size(model->bone_ends.size());
+    for (const auto& bone_end : model->bone_ends) {
+        writer.write(bone_end.first);
+        writer.write(bone_end.second);
+    }
+    writer.write(model->offsets.data(), model->n_bones);
+    writer.write(model->default_pose.positions.data(), model->n_bones);
+    writer.write(model->default_pose.rotations.data(), model->n_bones);
+    writer.write(model->default_pose.scales.data(), model->n_bones);
+    writer.write_size(model->n_skeleton_lods);
+    for (size_t i = 0; i < model->n_skeleton_lods; i++) {
+        writer.write_bone_set(model->skeleton_lod_bones[i]);
+        writer.write(model->skeleton_lod_remap[i].data(), model->n_bones);
+    }
+
+    bool ok = writer.is_ok();
+    fclose(file);
+    if (not ok) {
+        fprintf(stderr, "Failed to write \"%s\".\n", path);
+    }
+    return ok;
+}
+
+bool read_model_cache(Model* model, const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) {
+        fprintf(stderr, "Failed to open \"%s\".\n", path);
+        return false;
+    }
+    CacheReader reader {file};
+    char magic[4];
+    reader.read(magic, sizeof(magic));
+    bool ok = reader.is_ok() and std::memcmp(magic, MODEL_MAGIC, sizeof(MODEL_MAGIC)) == 0;
+
+    if (ok) {
+        model->n_meshes = reader.read_size(MAX_MESHES);
+        for (size_t i = 0; i < model->n_meshes; i++) {
+            Mesh& mesh = model->meshes[i];
+            reader.read(mesh.material_h);
+            mesh.n_lods = reader.read_size(MAX_LODS);
+            reader.read(mesh.lods.data(), mesh.n_lods);
+            reader.read_bone_set(mesh.bones);
+        }
+        model->n_materials = reader.read_size(MAX_MESHES);
+        for (size_t i = 0; i < model->n_materials; i++) {
+            reader.read_string(model->materials[i].diffuse_path);
+            model->materials[i].diffuse_tex = 0;
+        }
+        model->vertices.resize(reader.read_count<VertPNUBiBw>(UINT32_MAX));
+        reader.read(model->vertices.data(), model->vertices.size());
+        model->indices.resize(reader.read_count<GLuint>(UINT32_MAX));
+        reader.read(model->indices.data(), model->indices.size());
+        reader.read(model->bbox);
+        reader.read(model->bone_bounds);
+
+        model->n_bones = reader.read_size(MAX_BONES);
+        model->bone_names.clear();
+        std::string name;
+        for (size_t i = 0; i < model->n_bones; i++) {
+            reader.read_string(name);
+            if (not name.empty()) {
+                model->bone_names.insert(name.data(), name.size(), i);
+            }
+        }
+        model->parent_ids.fill(UINT8_MAX);
+        reader.read(model->parent_ids.data(), model->n_bones);
+        model->bone_ends.resize(reader.read_count<uint8_t>(UINT16_MAX));
+        for (auto& bone_end : model->bone_ends) {
+            reader.read(bone_end.first);
+            reader.read(bone_end.second);
+        }
+        reader.read(model->offsets.data(), model->n_bones);
+        reader.read(model->default_pose.positions.data(), model->n_bones);
+        reader.read(model->default_pose.rotations.data(), model->n_bones);
+        reader.read(model->default_pose.scales.data(), model->n_bones);
+        model->n_skeleton_lods = reader.read_size(MAX_LODS);
+        for (size_t i = 0; i < model->n_skeleton_lods; i++) {
+            reader.read_bone_set(model->skeleton_lod_bones[i]);
+            reader.read(model->skeleton_lod_remap[i].data(), model->n_bones);
+        }
+        ok = reader.is_ok() and is_model_valid(model) and model->bone_names.build();
+    }
+    fclose(file);
+    if (not ok) {
+        fprintf(stderr, "Failed to read model cache \"%s\".\n", path);
+    }
+    return ok;
+}
+
+bool write_animation_cache(const Animation* animation, const char* path)
+{
+    FILE* file = fopen(path, "wb");
+    if (file == nullptr) {
+        fprintf(stderr, "Failed to open \"%s\" for writing.\n", path);
+        return false;
+    }
+    CacheWriter writer {file};
+    writer.write(ANIMATION_MAGIC, sizeof(ANIMATION_MAGIC));
+    writer.write(animation->duration);
+    writer.write(static_cast<uint8_t>(animation->is_additive));
+    writer.write_size(animation->n_channels);
+    for (size_t i = 0; i < animation->n_channels; i++) {
+        const Channel& channel = animation->channels[i];
+        writer.write(channel.bone_id);
+        writer.write_size(channel.position_keys.size());
+        writer.write(channel.position_keys.data(), channel.position_keys.size());
+        writer.write_size(channel.rotation_keys.size());
+        writer.write(channel.rotation_keys.data(), channel.rotation_keys.size());
+        writer.write_size(channel.scale_keys.size());
+        writer.write(channel.scale_keys.data(), channel.scale_keys.size());
+    }
+    bool ok = writer.is_ok();
+    fclose(file);
+    if (not ok) {
+        fprintf(stderr, "Failed to write \"%s\".\n", path);
+    }
+    return ok;
+}
+
+bool read_animation_cache(Animation* animation, const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) {
+        fprintf(stderr, "Failed to open \"%s\".\n", path);
+        return false;
+    }
+    CacheReader reader {file};
+    char magic[4];
+    reader.read(magic, sizeof(magic));
+    bool ok = reader.is_ok() and std::memcmp(magic, ANIMATION_MAGIC, sizeof(ANIMATION_MAGIC)) == 0;
+    if (ok) {
+        uint8_t is_additive = 0;
+        reader.read(animation->duration);
+        reader.read(is_additive);
+        animation->is_additive = is_additive != 0;
+        animation->n_channels = reader.read_size(MAX_BONES);
+        for (size_t i = 0; i < animation->n_channels; i++) {
+            Channel& channel = animation->channels[i];
+            reader.read(channel.bone_id);
+            channel.position_keys.resize(reader.read_count<Key<glm::vec3>>(UINT32_MAX));
+            reader.read(channel.position_keys.data(), channel.position_keys.size());
+            channel.rotation_keys.resize(reader.read_count<Key<glm::quat>>(UINT32_MAX));
+            reader.read(channel.rotation_keys.data(), channel.rotation_keys.size());
+            channel.scale_keys.resize(reader.read_count<Key<glm::vec3>>(UINT32_MAX));
+            reader.read(channel.scale_keys.data(), channel.scale_keys.size());
+        }
+        ok = reader.is_ok();
+    }
+    fclose(file);
+    if (not ok) {
+        fprintf(stderr, "Failed to read animation cache \"%s\".\n", path);
+    }
+    return ok;
+}
+
+bool write_texture_cache(const std::vector<uint8_t>& pixels, size_t width, size_t height, const char* path)
+{
+    FILE* file = fopen(path, "wb");
+    if (file == nullptr) {
+        fprintf(stderr, "Failed to open \"%s\" for writing.\n", path);
+        return false;
+    }
+    CacheWriter writer {file};
+    writer.write(TEXTURE_MAGIC, sizeof(TEXTURE_MAGIC));
+    writer.write(static_cast<uint32_t>(width));
+    writer.write(static_cast<uint32_t>(height));
+    writer.write(pixels.data(), pixels.size());
+    bool ok = writer.is_ok();
+    fclose(file);
+    if (not ok) {
+        fprintf(stderr, "Failed to write \"%s\".\n", path);
+    }
+    return ok;
+}
+
+bool read_texture_cache(std::vector<uint8_t>& pixels, size_t& width, size_t& height, const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) {
+        fprintf(stderr, "Failed to open \"%s\".\n", path);
+        return false;
+    }
+    CacheReader reader {file};
+    char magic[4];
+    uint32_t size[2] = {0, 0};
+    reader.read(magic, sizeof(magic));
+    reader.read(size, 2);
+    bool ok = reader.is_ok() and std::memcmp(magic, TEXTURE_MAGIC, sizeof(TEXTURE_MAGIC)) == 0;
+    ok = ok and size[0] <= MAX_TEXTURE_SIZE and size[1] <= MAX_TEXTURE_SIZE;
+    if (ok) {
+        width = size[0];
+        height = size[1];
+        // Only allocated once the file is known to hold that many pixels.
+        ok = reader.get_remaining_size() >= 4 * width * height;
+    }
+    if (ok) {
+        pixels.resize(4 * width * height);
+        reader.read(pixels.data(), pixels.size());
+        ok = reader.is_ok();
+    }
+    fclose(file);
+    if (not ok) {
+        fprintf(stderr, "Failed to read texture cache \"%s\".\n", path);
+    }
+    return ok;
+}
@@ -0,0 +1,455 @@
+#include "arena.hpp"
+#include "draw.hpp"
+#include "image.hpp"
+#include "model.hpp"
+#include "model_cache.hpp"
+#include "shader.hpp"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+#include <glad/glad.h>
+#include <glm/gtc/type_ptr.hpp>
+
+// Uniform buffer binding point of the skinning palette in model.vert.
+static const GLuint PALETTE_BINDING = 0;
+// Room for a few frames of crowd palettes at up to 6.4 KB each.
+static const size_t PALETTE_RING_SIZE = 1 << 20;
+
+bool ModelManager::init()
+{
+    GLuint vert, frag;
+    vert = sm_->make_shader(GL_VERTEX_SHADER, "shaders/model.vert");
+    frag = sm_->make_shader(GL_FRAGMENT_SHADER, "shaders/model.frag");
+    program_ = sm_->make_program({vert, frag});
+    glDeleteShader(vert);
+    glDeleteShader(frag);
+    if (program_ == 0u) return false;
+    loc_projection_ = glGetUniformLocation(program_, "projection");
+    loc_view_ = glGetUniformLocation(program_, "view");
+    loc_diffuse_tex_ = glGetUniformLocation(program_, "diffuse_tex");
+    glUniformBlockBinding(program_, glGetUniformBlockIndex(program_, "Palette"), PALETTE_BINDING);
+    GLint offset_alignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &offset_alignment);
+    size_t alignment = std::max<GLint>(offset_alignment, 1);
+    // The bound range has to cover the whole Palette block.
+    palette_slot_size_ = (sizeof(Pose) + alignment - 1) / alignment * alignment;
+    palette_ring_offset_ = 0;
+    glGenBuffers(1, &palette_ring_);
+    glBindBuffer(GL_UNIFORM_BUFFER, palette_ring_);
+    glBufferData(GL_UNIFORM_BUFFER, PALETTE_RING_SIZE, nullptr, GL_STREAM_DRAW);
+
+    vert = sm_->make_shader(GL_VERTEX_SHADER, "shaders/model_baked.vert");
+    frag = sm_->make_shader(GL_FRAGMENT_SHADER, "shaders/model.frag");
+    baked_program_ = sm_->make_program({vert, frag});
+    glDeleteShader(vert);
+    glDeleteShader(frag);
+    if (baked_program_ == 0u) return false;
+    loc_baked_projection_ = glGetUniformLocation(baked_program_, "projection");
+    loc_baked_view_ = glGetUniformLocation(baked_program_, "view");
+    loc_baked_palette_tex_ = glGetUniformLocation(baked_program_, "palette_tex");
+    loc_baked_n_frames_ = glGetUniformLocation(baked_program_, "n_frames");
+    loc_baked_frame_ = glGetUniformLocation(baked_program_, "frame");
+    loc_baked_diffuse_tex_ = glGetUniformLocation(baked_program_, "diffuse_tex");
+
+    vert = sm_->make_shader(GL_VERTEX_SHADER, "shaders/model_vat.vert");
+    frag = sm_->make_shader(GL_FRAGMENT_SHADER, "shaders/model.frag");
+    vat_program_ = sm_->make_program({vert, frag});
+    glDeleteShader(vert);
+    glDeleteShader(frag);
+    if (vat_program_ == 0u) return false;
+    loc_vat_projection_ = glGetUniformLocation(vat_program_, "projection");
+    loc_vat_view_ = glGetUniformLocation(vat_program_, "view");
+    loc_vat_position_tex_ = glGetUniformLocation(vat_program_, "position_tex");
+    loc_vat_normal_tex_ = glGetUniformLocation(vat_program_, "normal_tex");
+    loc_vat_n_vertices_ = glGetUniformLocation(vat_program_, "n_vertices");
+    loc_vat_n_frames_ = glGetUniformLocation(vat_program_, "n_frames");
+    loc_vat_frame_ = glGetUniformLocation(vat_program_, "frame");
+    loc_vat_bounds_min_ = glGetUniformLocation(vat_program_, "bounds_min");
+    loc_vat_bounds_size_ = glGetUniformLocation(vat_program_, "bounds_size");
+    loc_vat_diffuse_tex_ = glGetUniformLocation(vat_program_, "diffuse_tex");
+
+    du_->make_n_colors(bone_colors_, 12);
+    return true;
+}
+
+bool ModelManager::load_model(
+        Model* model,
+        Animation* animation,
+        const char* path,
+        ImportProfile profile
+        )
+{
+    if (not import_model(model, animation, path, profile)) {
+        return false;
+    }
+    upload_model(model);
+    return true;
+}
+
+void ModelManager::upload_model(Model* model)
+{
+    for (size_t i = 0; i < model->n_materials; i++) {
+        Material& mat = model->materials[i];
+        mat.diffuse_tex = il_->make_texture_from_image(mat.diffuse_path.c_str());
+    }
+    upload_buffers(model);
+}
+
+bool ModelManager::load_cached_model(Model* model, Animation* animation, const char* cache_path)
+{
+    std::string s_path (cache_path);
+    std::string base_dir = s_path.substr(0, s_path.find_last_of('/'));
+    if (not read_model_cache(model, (s_path + ".model").c_str())) {
+        return false;
+    }
+    // Clips are only written for models that have one.
+    std::string animation_path = s_path + ".clip";
+    animation->n_channels = 0;
+    if (access(animation_path.c_str(), R_OK) == 0 and not read_animation_cache(animation, animation_path.c_str())) {
+        return false;
+    }
+    for (size_t i = 0; i < animation->n_channels; i++) {
+        if (animation->channels[i].bone_id >= model->n_bones) {
+            fprintf(stderr, "Failed to load \"%s\", it animates bones the model does not have.\n", animation_path.c_str());
+            return false;
+        }
+    }
+    // Cached materials name their texture relative to the model, or
+    // nothing if the source texture was missing.
+    std::vector<uint8_t> pixels;
+    for (size_t i = 0; i < model->n_materials; i++) {
+        Material& mat = model->materials[i];
+        mat.diffuse_tex = 0u;
+        if (mat.diffuse_path.empty()) continue;
+        std::string texture_path = base_dir + "/" + mat.diffuse_path;
+        size_t width = 0, height = 0;
+        if (not read_texture_cache(pixels, width, height, texture_path.c_str())) {
+            return false;
+        }
+        mat.diffuse_tex = il_->make_texture_from_pixels(pixels, width, height);
+    }
+    upload_buffers(model);
+    return true;
+}
+
+void ModelManager::upload_buffers(Model* model)
+{
+    glGenVertexArrays(1, &model->vao);
+    glGenBuffers(1, &model->vbo);
+    glGenBuffers(1, &model->ebo);
+    glBindVertexArray(model->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, model->vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(VertPNUBiBw) * model->vertices.size(), model->vertices.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glEnableVertexAttribArray(2);
+    glEnableVertexAttribArray(3);
+    glEnableVertexAttribArray(4);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(VertPNUBiBw), reinterpret_cast<GLvoid*>(offsetof(VertPNUBiBw, position)));
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_TRUE, sizeof(VertPNUBiBw), reinterpret_cast<GLvoid*>(offsetof(VertPNUBiBw, normal)));
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(VertPNUBiBw), reinterpret_cast<GLvoid*>(offsetof(VertPNUBiBw, tex_coord)));
+    glVertexAttribIPointer(3, 4, GL_INT, sizeof(VertPNUBiBw), reinterpret_cast<GLvoid*>(offsetof(VertPNUBiBw, bone_ids)));
+    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(VertPNUBiBw), reinterpret_cast<GLvoid*>(offsetof(VertPNUBiBw, bone_weights)));
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model->ebo); 
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * model->indices.size(), model->indices.data(), GL_STATIC_READ);
+}
+
+void ModelManager::draw_model(
+        Model* model,
+        const LocalPose& pose,
+        const glm::mat4& projection,
+        const glm::mat4& view,
+        size_t lod
+        )
+{
+    PoseView palette {get_frame_arena().allocate<glm::mat4>(model->n_bones), model->n_bones};
+    convert_local_to_global_pose(palette, model, pose, true, lod);
+    draw_model_palette(model, palette, projection, view, lod);
+}
+
+void ModelManager::draw_model_palette(
+        Model* model,
+        ConstPoseView palette,
+        const glm::mat4& projection,
+        const glm::mat4& view,
+        size_t lod
+        )
+{
+    // Every draw writes its palette to a fresh slot of the ring, so the
+    // driver never has to wait for an earlier draw that still reads one.
+    // Wrapping orphans the buffer, which leaves the storage of draws still
+    // in flight alone.
+    glBindBuffer(GL_UNIFORM_BUFFER, palette_ring_);
+    if (palette_ring_offset_ + palette_slot_size_ > PALETTE_RING_SIZE) {
+        glBufferData(GL_UNIFORM_BUFFER, PALETTE_RING_SIZE, nullptr, GL_STREAM_DRAW);
+        palette_ring_offset_ = 0;
+    }
+    size_t palette_offset = palette_ring_offset_;
+    palette_ring_offset_ += palette_slot_size_;
+    size_t palette_size = sizeof(glm::mat4) * model->n_bones;
+    void* slot = glMapBufferRange(
+        GL_UNIFORM_BUFFER, palette_offset, palette_size,
+        GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT
+        );
+    if (slot == nullptr) return;
+    memcpy(slot, palette.data, palette_size);
+    glUnmapBuffer(GL_UNIFORM_BUFFER);
+    draw_palette_buffer(model, palette_ring_, palette_offset, projection, view, lod);
+}
+
+void ModelManager::draw_model_state(
+        Model* model,
+        PoseState* state,
+        const glm::mat4& projection,
+        const glm::mat4& view,
+        size_t lod
+        )
+{
+    // Upload each run of changed palette entries with one call.
+    glBindBuffer(GL_UNIFORM_BUFFER, state->palette_ubo);
+    size_t i = 0;
+    while (i < model->n_bones) {
+        if (not state->palette_dirty.test(i)) {
+            i++;
+            continue;
+        }
+        size_t begin = i;
+        while (i < model->n_bones and state->palette_dirty.test(i)) {
+            i++;
+        }
+        glBufferSubData(
+            GL_UNIFORM_BUFFER,
+            sizeof(glm::mat4) * begin,
+            sizeof(glm::mat4) * (i - begin),
+            &state->palette[begin]
+            );
+    }
+    state->palette_dirty.reset();
+    draw_palette_buffer(model, state->palette_ubo, 0, projection, view, lod);
+}
+
+void ModelManager::draw_palette_buffer(
+        Model* model,
+        GLuint palette_ubo,
+        size_t palette_offset,
+        const glm::mat4& projection,
+        const glm::mat4& view,
+        size_t lod
+        )
+{
+    glUseProgram(program_);
+    glBindVertexArray(model->vao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model->ebo);
+    glBindBufferRange(GL_UNIFORM_BUFFER, PALETTE_BINDING, palette_ubo, palette_offset, sizeof(Pose));
+    glUniformMatrix4fv(loc_projection_, 1, GL_FALSE, glm::value_ptr(projection));
+    glUniformMatrix4fv(loc_view_, 1, GL_FALSE, glm::value_ptr(view));
+    glActiveTexture(GL_TEXTURE1);
+    for (size_t i = 0; i < model->n_meshes; i++) {
+        const Mesh& mesh = model->meshes[i];
+        const MeshLod& mesh_lod = mesh.lods[std::min(lod, mesh.n_lods - 1)];
+        glBindTexture(GL_TEXTURE_2D, model->materials[mesh.material_h].diffuse_tex);
+        glUniform1i(loc_diffuse_tex_, 1);
+        glDrawElements(GL_TRIANGLES, mesh_lod.count, GL_UNSIGNED_INT, reinterpret_cast<GLvoid*>(sizeof(GLuint) * mesh_lod.offset));
+    }
+}
+
+bool ModelManager::bake_animation(BakedAnimation* baked, Model* model, Animation* animation, float frame_rate)
+{
+    float duration = animation->duration / ANIMATION_TICKS_PER_SECOND;
+    size_t n_frames = std::max<size_t>(1, static_cast<size_t>(glm::round(duration * frame_rate)));
+    size_t row_size = 3 * model->n_bones;
+
+    // Frames evenly divide the clip so the last one interpolates back into
+    // the first.
+    std::vector<glm::vec4> texels (row_size * n_frames);
+    LocalPose local_pose;
+    Pose palette;
+    for (size_t i = 0; i < n_frames; i++) {
+        float time = duration * i / n_frames;
+        update_pose(model, local_pose, animation, time);
+        convert_local_to_global_pose(palette, model, local_pose, true);
+        glm::vec4* row = &texels[i * row_size];
+        for (size_t j = 0; j < model->n_bones; j++) {
+            glm::mat4 transposed = glm::transpose(palette[j]);
+            row[3 * j + 0] = transposed[0];
+            row[3 * j + 1] = transposed[1];
+            row[3 * j + 2] = transposed[2];
+        }
+    }
+
+    glGenTextures(1, &baked->palette_tex);
+    glBindTexture(GL_TEXTURE_2D, baked->palette_tex);
+    glTexImage2D(
+        GL_TEXTURE_2D,
+        0, GL_RGBA32F, row_size, n_frames,
+        0, GL_RGBA, GL_FLOAT, texels.data()
+        );
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    baked->n_frames = n_frames;
+    baked->duration = duration;
+    printf(
+        "Baked %zu frames of %zu bones (%zu KB).\n",
+        n_frames, model->n_bones, texels.size() * sizeof(glm::vec4) / 1024
+        );
+    return true;
+}
+
+void ModelManager::draw_model_baked(
+        Model* model,
+        const BakedAnimation* baked,
+        float time,
+        const glm::mat4& projection,
+        const glm::mat4& view,
+        size_t lod
+        )
+{
+    float looped_time = time - glm::floor(time / baked->duration) * baked->duration;
+    float frame = looped_time / baked->duration * baked->n_frames;
+
+    glUseProgram(baked_program_);
+    glBindVertexArray(model->vao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model->ebo);
+    glUniformMatrix4fv(loc_baked_projection_, 1, GL_FALSE, glm::value_ptr(projection));
+    glUniformMatrix4fv(loc_baked_view_, 1, GL_FALSE, glm::value_ptr(view));
+    glUniform1i(loc_baked_n_frames_, static_cast<GLint>(baked->n_frames));
+    glUniform1f(loc_baked_frame_, frame);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, baked->palette_tex);
+    glUniform1i(loc_baked_palette_tex_, 2);
+    glActiveTexture(GL_TEXTURE1);
+    for (size_t i = 0; i < model->n_meshes; i++) {
+        const Mesh& mesh = model->meshes[i];
+        const MeshLod& mesh_lod = mesh.lods[std::min(lod, mesh.n_lods - 1)];
+        glBindTexture(GL_TEXTURE_2D, model->materials[mesh.material_h].diffuse_tex);
+        glUniform1i(loc_baked_diffuse_tex_, 1);
+        glDrawElements(GL_TRIANGLES, mesh_lod.count, GL_UNSIGNED_INT, reinterpret_cast<GLvoid*>(sizeof(GLuint) * mesh_lod.offset));
+    }
+}
+
+void ModelManager::upload_vertex_animation(VertexAnimation* vat)
+{
+    // Rows are padded up to the full texture width.
+    size_t n_texels = vat->n_vertices * vat->n_frames;
+    size_t height = (n_texels + VAT_TEXTURE_WIDTH - 1) / VAT_TEXTURE_WIDTH;
+    std::vector<uint16_t> positions (4 * VAT_TEXTURE_WIDTH * height, 0);
+    std::vector<int8_t> normals (4 * VAT_TEXTURE_WIDTH * height, 0);
+    std::copy(vat->positions.begin(), vat->positions.end(), positions.begin());
+    std::copy(vat->normals.begin(), vat->normals.end(), normals.begin());
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glGenTextures(1, &vat->position_tex);
+    glBindTexture(GL_TEXTURE_2D, vat->position_tex);
+    glTexImage2D(
+        GL_TEXTURE_2D,
+        0, GL_RGBA16, VAT_TEXTURE_WIDTH, height,
+        0, GL_RGBA, GL_UNSIGNED_SHORT, positions.data()
+        );
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glGenTextures(1, &vat->normal_tex);
+    glBindTexture(GL_TEXTURE_2D, vat->normal_tex);
+    glTexImage2D(
+        GL_TEXTURE_2D,
+        0, GL_RGBA8_SNORM, VAT_TEXTURE_WIDTH, height,
+        0, GL_RGBA, GL_BYTE, normals.data()
+        );
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+void ModelManager::draw_model_vat(
+        Model* model,
+        const VertexAnimation* vat,
+        float time,
+        const glm::mat4& projection,
+        const glm::mat4& view,
+        size_t lod
+        )
+{
+    float looped_time = time - glm::floor(time / vat->duration) * vat->duration;
+    float frame = looped_time / vat->duration * vat->n_frames;
+    glm::vec3 bounds_size = vat->bounds.max - vat->bounds.min;
+
+    glUseProgram(vat_program_);
+    glBindVertexArray(model->vao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model->ebo);
+    glUniformMatrix4fv(loc_vat_projection_, 1, GL_FALSE, glm::value_ptr(projection));
+    glUniformMatrix4fv(loc_vat_view_, 1, GL_FALSE, glm::value_ptr(view));
+    glUniform1i(loc_vat_n_vertices_, static_cast<GLint>(vat->n_vertices));
+    glUniform1i(loc_vat_n_frames_, static_cast<GLint>(vat->n_frames));
+    glUniform1f(loc_vat_frame_, frame);
+    glUniform3fv(loc_vat_bounds_min_, 1, glm::value_ptr(vat->bounds.min));
+    glUniform3fv(loc_vat_bounds_size_, 1, glm::value_ptr(bounds_size));
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, vat->position_tex);
+    glUniform1i(loc_vat_position_tex_, 2);
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, vat->normal_tex);
+    glUniform1i(loc_vat_normal_tex_, 3);
+    glActiveTexture(GL_TEXTURE1);
+    for (size_t i = 0; i < model->n_meshes; i++) {
+        const Mesh& mesh = model->meshes[i];
+        const MeshLod& mesh_lod = mesh.lods[std::min(lod, mesh.n_lods - 1)];
+        glBindTexture(GL_TEXTURE_2D, model->materials[mesh.material_h].diffuse_tex);
+        glUniform1i(loc_vat_diffuse_tex_, 1);
+        glDrawElements(GL_TRIANGLES, mesh_lod.count, GL_UNSIGNED_INT, reinterpret_cast<GLvoid*>(sizeof(GLuint) * mesh_lod.offset));
+    }
+}
+
+void ModelManager::draw_skeleton(
+        Model* model,
+        const LocalPose& pose,
+        const glm::mat4& projection,
+        const glm::mat4& view,
+        size_t lod
+        )
+{
+    glDisable(GL_DEPTH_TEST);
+    LinearArena& arena = get_frame_arena();
+    PoseView global_pose {arena.allocate<glm::mat4>(model->n_bones), model->n_bones};
+    convert_local_to_global_pose(global_pose, model, pose, false, lod);
+    VertPC* vertices = arena.allocate<VertPC>(2 * (model->n_bones + model->bone_ends.size()));
+    size_t n_vertices = 0;
+    size_t color_id = 0;
+    for (size_t i = 0; i < model->n_bones; i++) {
+        if (model->parent_ids[i] < model->n_bones) {
+            glm::vec3 color = bone_colors_[color_id++ % bone_colors_.size()];
+            vertices[n_vertices++] = {
+                glm::vec3{global_pose[i] * glm::vec4{0.f, 0.f, 0.f, 1.f}},
+                color
+            };
+            vertices[n_vertices++] = {
+                glm::vec3{global_pose[model->parent_ids[i]] *
+                glm::vec4{0.f, 0.f, 0.f, 1.f}},
+                color
+            };
+        }
+    }
+    for (auto bone_end : model->bone_ends) {
+        glm::vec3 color = bone_colors_[color_id++ % bone_colors_.size()];
+        vertices[n_vertices++] = {
+            glm::vec3{global_pose[bone_end.first] * glm::vec4{0.f, 0.f, 0.f, 1.f}},
+            color
+        };
+        vertices[n_vertices++] = {
+            glm::vec3{global_pose[bone_end.first] * glm::vec4{bone_end.second, 1.f}},
+            color
+        };
+    }
+    glPointSize(5.f);
+    du_->draw(GL_LINES, projection, view, vertices, n_vertices);
+    du_->draw(GL_POINTS, projection, view, vertices, n_vertices);
+}
+
+void ModelManager::init_pose_state(PoseState* state, const Model* model)
+{
+    state->local_pose = model->default_pose;
+    state->dirty.set();
+    state->palette_dirty.set();
+    glGenBuffers(1, &state->palette_ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, state->palette_ubo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(Pose), nullptr, GL_DYNAMIC_DRAW);
+}
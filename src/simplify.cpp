@@ -0,0 +1,296 @@
+#include "simplify.hpp"
+#include <algorithm>
+#include <cstring>
+#include <queue>
+#include <unordered_map>
+#include <glm/glm.hpp>
+
+namespace {
+
+// Symmetric 4x4 quadric stored as its upper triangle.
+struct Quadric
+{
+    double a[10] = {};
+
+    static Quadric from_plane(const glm::vec3& n, double d, double weight)
+    {
+        Quadric q;
+        q.a[0] = n.x * n.x; q.a[1] = n.x * n.y; q.a[2] = n.x * n.z; q.a[3] = n.x * d;
+        q.a[4] = n.y * n.y; q.a[5] = n.y * n.z; q.a[6] = n.y * d;
+        q.a[7] = n.z * n.z; q.a[8] = n.z * d;
+        q.a[9] = d * d;
+        for (double& value : q.a) {
+            value *= weight;
+        }
+        return q;
+    }
+
+    void add(const Quadric& that)
+    {
+        for (size_t i = 0; i < 10; i++) {
+            a[i] += that.a[i];
+        }
+    }
+
+    double evaluate(const glm::vec3& v) const
+    {
+        double x = v.x, y = v.y, z = v.z;
+        return (
+            a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z + 2 * a[3] * x +
+            a[4] * y * y + 2 * a[5] * y * z + 2 * a[6] * y +
+            a[7] * z * z + 2 * a[8] * z +
+            a[9]
+            );
+    }
+};
+
+struct Collapse
+{
+    double cost;
+    uint32_t from;
+    uint32_t to;
+    uint32_t from_version;
+    uint32_t to_version;
+
+    bool operator>(const Collapse& that) const
+    {
+        return cost > that.cost;
+    }
+};
+
+struct PositionHash
+{
+    size_t operator()(const glm::vec3& p) const
+    {
+        uint32_t bits[3];
+        std::memcpy(bits, &p, sizeof(bits));
+        return bits[0] * 73856093u ^ bits[1] * 19349663u ^ bits[2] * 83492791u;
+    }
+};
+
+}
+
+static float bone_weight_similarity(const VertPNUBiBw& lhs, const VertPNUBiBw& rhs)
+{
+    float similarity = 0.f;
+    for (size_t i = 0; i < 4; i++) {
+        for (size_t j = 0; j < 4; j++) {
+            if (lhs.bone_ids[i] == rhs.bone_ids[j]) {
+                similarity += std::min(lhs.bone_weights[i], rhs.bone_weights[j]);
+            }
+        }
+    }
+    return similarity;
+}
+
+size_t simplify_indices(
+        std::vector<GLuint>& lod_indices,
+        const std::vector<VertPNUBiBw>& vertices,
+        const std::vector<GLuint>& indices,
+        size_t target_triangles
+        )
+{
+    const double BONE_BOUNDARY_PENALTY = 1.0;
+    const float MIN_FLIP_COSINE = 0.2f;
+
+    lod_indices.clear();
+    size_t n_triangles = indices.size() / 3;
+    if (n_triangles <= target_triangles) {
+        lod_indices = indices;
+        return n_triangles;
+    }
+
+    // Work on a compact local range of the shared vertex buffer.
+    GLuint base = *std::min_element(indices.begin(), indices.end());
+    GLuint n_local = *std::max_element(indices.begin(), indices.end()) - base + 1;
+    std::vector<uint32_t> triangles (indices.size());
+    for (size_t i = 0; i < indices.size(); i++) {
+        triangles[i] = indices[i] - base;
+    }
+    auto position = [&](uint32_t v) -> const glm::vec3& {
+        return vertices[base + v].position;
+    };
+
+    // Vertices sharing a position are split along a UV or normal seam.
+    std::vector<uint32_t> group (n_local);
+    std::vector<uint32_t> group_size (n_local, 0);
+    std::unordered_map<glm::vec3, uint32_t, PositionHash> group_of_position;
+    for (uint32_t v = 0; v < n_local; v++) {
+        auto inserted = group_of_position.insert({position(v), v});
+        group[v] = inserted.first->second;
+        group_size[group[v]]++;
+    }
+
+    std::vector<std::vector<uint32_t>> vertex_triangles (n_local);
+    std::vector<Quadric> quadrics (n_local);
+    std::vector<bool> triangle_alive (n_triangles, true);
+    for (uint32_t t = 0; t < n_triangles; t++) {
+        const glm::vec3& p0 = position(triangles[3 * t + 0]);
+        const glm::vec3& p1 = position(triangles[3 * t + 1]);
+        const glm::vec3& p2 = position(triangles[3 * t + 2]);
+        glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+        float area = glm::length(normal);
+        if (area > 0.f) {
+            normal /= area;
+        }
+        Quadric quadric = Quadric::from_plane(normal, -glm::dot(normal, p0), area);
+        for (size_t i = 0; i < 3; i++) {
+            uint32_t v = triangles[3 * t + i];
+            vertex_triangles[v].push_back(t);
+            quadrics[group[v]].add(quadric);
+        }
+    }
+
+    // An edge used by a single triangle is on an open border.
+    std::unordered_map<uint64_t, uint32_t> edge_uses;
+    for (uint32_t t = 0; t < n_triangles; t++) {
+        for (size_t i = 0; i < 3; i++) {
+            uint32_t a = group[triangles[3 * t + i]];
+            uint32_t b = group[triangles[3 * t + (i + 1) % 3]];
+            edge_uses[(uint64_t{std::min(a, b)} << 32) | std::max(a, b)]++;
+        }
+    }
+    std::vector<bool> locked (n_local, false);
+    for (uint32_t v = 0; v < n_local; v++) {
+        locked[v] = group_size[group[v]] > 1;
+    }
+    for (uint32_t t = 0; t < n_triangles; t++) {
+        for (size_t i = 0; i < 3; i++) {
+            uint32_t a = triangles[3 * t + i];
+            uint32_t b = triangles[3 * t + (i + 1) % 3];
+            uint32_t ga = group[a];
+            uint32_t gb = group[b];
+            if (edge_uses[(uint64_t{std::min(ga, gb)} << 32) | std::max(ga, gb)] == 1) {
+                locked[a] = true;
+                locked[b] = true;
+            }
+        }
+    }
+
+    std::vector<uint32_t> version (n_local, 0);
+    std::vector<bool> removed (n_local, false);
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> queue;
+
+    auto collapse_cost = [&](uint32_t from, uint32_t to) {
+        const VertPNUBiBw& from_vert = vertices[base + from];
+        const VertPNUBiBw& to_vert = vertices[base + to];
+        Quadric quadric = quadrics[group[from]];
+        quadric.add(quadrics[group[to]]);
+        glm::vec3 edge = to_vert.position - from_vert.position;
+        double penalty = (1.0 - bone_weight_similarity(from_vert, to_vert)) * glm::dot(edge, edge);
+        return quadric.evaluate(to_vert.position) + BONE_BOUNDARY_PENALTY * penalty;
+    };
+    auto push_collapse = [&](uint32_t from, uint32_t to) {
+        if (locked[from] or removed[from] or removed[to] or from == to) return;
+        queue.push({collapse_cost(from, to), from, to, version[from], version[to]});
+    };
+    for (uint32_t t = 0; t < n_triangles; t++) {
+        for (size_t i = 0; i < 3; i++) {
+            uint32_t a = triangles[3 * t + i];
+            uint32_t b = triangles[3 * t + (i + 1) % 3];
+            push_collapse(a, b);
+            push_collapse(b, a);
+        }
+    }
+
+    size_t n_alive = n_triangles;
+    std::vector<uint32_t> from_neighbors;
+    std::vector<uint32_t> to_neighbors;
+    auto gather_neighbors = [&](std::vector<uint32_t>& neighbors, uint32_t v) {
+        neighbors.clear();
+        for (uint32_t t : vertex_triangles[v]) {
+            if (not triangle_alive[t]) continue;
+            for (size_t i = 0; i < 3; i++) {
+                if (triangles[3 * t + i] != v) {
+                    neighbors.push_back(triangles[3 * t + i]);
+                }
+            }
+        }
+        std::sort(neighbors.begin(), neighbors.end());
+        neighbors.erase(std::unique(neighbors.begin(), neighbors.end()), neighbors.end());
+    };
+
+    while (n_alive > target_triangles and not queue.empty()) {
+        Collapse collapse = queue.top();
+        queue.pop();
+        uint32_t from = collapse.from;
+        uint32_t to = collapse.to;
+        if (removed[from] or removed[to]) continue;
+        if (collapse.from_version != version[from] or collapse.to_version != version[to]) {
+            push_collapse(from, to);
+            continue;
+        }
+
+        // Link condition: the edge must still exist and be shared by at most
+        // two triangles' worth of common neighbours to keep the mesh manifold.
+        gather_neighbors(from_neighbors, from);
+        if (not std::binary_search(from_neighbors.begin(), from_neighbors.end(), to)) continue;
+        gather_neighbors(to_neighbors, to);
+        size_t n_shared = 0;
+        for (uint32_t v : from_neighbors) {
+            if (std::binary_search(to_neighbors.begin(), to_neighbors.end(), v)) n_shared++;
+        }
+        if (n_shared > 2) continue;
+
+        bool flips = false;
+        for (uint32_t t : vertex_triangles[from]) {
+            if (not triangle_alive[t]) continue;
+            glm::vec3 before[3];
+            glm::vec3 after[3];
+            bool has_to = false;
+            for (size_t i = 0; i < 3; i++) {
+                uint32_t v = triangles[3 * t + i];
+                has_to = has_to or v == to;
+                before[i] = position(v);
+                after[i] = v == from ? position(to) : position(v);
+            }
+            if (has_to) continue;
+            glm::vec3 normal_before = glm::cross(before[1] - before[0], before[2] - before[0]);
+            glm::vec3 normal_after = glm::cross(after[1] - after[0], after[2] - after[0]);
+            float lengths = glm::length(normal_before) * glm::length(normal_after);
+            if (lengths <= 0.f or glm::dot(normal_before, normal_after) < MIN_FLIP_COSINE * lengths) {
+                flips = true;
+                break;
+            }
+        }
+        if (flips) continue;
+
+        for (uint32_t t : vertex_triangles[from]) {
+            if (not triangle_alive[t]) continue;
+            bool has_to = false;
+            for (size_t i = 0; i < 3; i++) {
+                has_to = has_to or triangles[3 * t + i] == to;
+            }
+            if (has_to) {
+                triangle_alive[t] = false;
+                n_alive--;
+                continue;
+            }
+            for (size_t i = 0; i < 3; i++) {
+                if (triangles[3 * t + i] == from) {
+                    triangles[3 * t + i] = to;
+                }
+            }
+            vertex_triangles[to].push_back(t);
+        }
+        removed[from] = true;
+        if (group[from] != group[to]) {
+            quadrics[group[to]].add(quadrics[group[from]]);
+        }
+        version[to]++;
+        gather_neighbors(to_neighbors, to);
+        for (uint32_t v : to_neighbors) {
+            push_collapse(v, to);
+            push_collapse(to, v);
+        }
+    }
+
+    lod_indices.reserve(n_alive * 3);
+    for (uint32_t t = 0; t < n_triangles; t++) {
+        if (not triangle_alive[t]) continue;
+        for (size_t i = 0; i < 3; i++) {
+            lod_indices.push_back(base + triangles[3 * t + i]);
+        }
+    }
+    return n_alive;
+}
@@ -0,0 +1,269 @@
+#include "skinning.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <glm/gtc/type_ptr.hpp>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SKINNING_X86 1
+#endif
+
+// Every kernel blends the upper 3x4 of the four weighted palette matrices,
+// then applies it to the position and (renormalized) normal. Element e of
+// the blended matrix is column e / 3, row e % 3.
+static const size_t N_AFFINE_ELEMENTS = 12;
+
+static inline size_t affine_offset(size_t e)
+{
+    return (e / 3) * 4 + e % 3;
+}
+
+static void skin_scalar(
+        SkinnedVertices& skinned,
+        const SkinningStream& stream,
+        const float* palette,
+        size_t begin,
+        size_t end
+        )
+{
+    for (size_t i = begin; i < end; i++) {
+        float m[N_AFFINE_ELEMENTS] = {};
+        for (size_t k = 0; k < 4; k++) {
+            float weight = stream.bone_weights[k][i];
+            const float* bone = palette + 16 * stream.bone_ids[k][i];
+            for (size_t e = 0; e < N_AFFINE_ELEMENTS; e++) {
+                m[e] += weight * bone[affine_offset(e)];
+            }
+        }
+        float x = stream.position_x[i];
+        float y = stream.position_y[i];
+        float z = stream.position_z[i];
+        skinned.position_x[i] = m[0] * x + m[3] * y + m[6] * z + m[9];
+        skinned.position_y[i] = m[1] * x + m[4] * y + m[7] * z + m[10];
+        skinned.position_z[i] = m[2] * x + m[5] * y + m[8] * z + m[11];
+        float nx = stream.normal_x[i];
+        float ny = stream.normal_y[i];
+        float nz = stream.normal_z[i];
+        float sx = m[0] * nx + m[3] * ny + m[6] * nz;
+        float sy = m[1] * nx + m[4] * ny + m[7] * nz;
+        float sz = m[2] * nx + m[5] * ny + m[8] * nz;
+        float inv_length = 1.f / std::sqrt(std::max(sx * sx + sy * sy + sz * sz, 1e-20f));
+        skinned.normal_x[i] = sx * inv_length;
+        skinned.normal_y[i] = sy * inv_length;
+        skinned.normal_z[i] = sz * inv_length;
+    }
+}
+
+#if defined(SKINNING_X86)
+static void skin_sse2(
+        SkinnedVertices& skinned,
+        const SkinningStream& stream,
+        const float* palette,
+        size_t begin,
+        size_t end
+        )
+{
+    for (size_t i = begin; i < end; i += 4) {
+        __m128 m[N_AFFINE_ELEMENTS];
+        for (size_t e = 0; e < N_AFFINE_ELEMENTS; e++) {
+            m[e] = _mm_setzero_ps();
+        }
+        for (size_t k = 0; k < 4; k++) {
+            const int32_t* ids = &stream.bone_ids[k][i];
+            __m128 weight = _mm_loadu_ps(&stream.bone_weights[k][i]);
+            const float* bone0 = palette + 16 * ids[0];
+            const float* bone1 = palette + 16 * ids[1];
+            const float* bone2 = palette + 16 * ids[2];
+            const float* bone3 = palette + 16 * ids[3];
+            for (size_t e = 0; e < N_AFFINE_ELEMENTS; e++) {
+                size_t offset = affine_offset(e);
+                __m128 element = _mm_setr_ps(bone0[offset], bone1[offset], bone2[offset], bone3[offset]);
+                m[e] = _mm_add_ps(m[e], _mm_mul_ps(weight, element));
+            }
+        }
+        __m128 x = _mm_loadu_ps(&stream.position_x[i]);
+        __m128 y = _mm_loadu_ps(&stream.position_y[i]);
+        __m128 z = _mm_loadu_ps(&stream.position_z[i]);
+        __m128 nx = _mm_loadu_ps(&stream.normal_x[i]);
+        __m128 ny = _mm_loadu_ps(&stream.normal_y[i]);
+        __m128 nz = _mm_loadu_ps(&stream.normal_z[i]);
+        __m128 out[3];
+        __m128 out_normal[3];
+        for (size_t r = 0; r < 3; r++) {
+            __m128 linear = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(m[r], x), _mm_mul_ps(m[3 + r], y)),
+                _mm_mul_ps(m[6 + r], z)
+                );
+            out[r] = _mm_add_ps(linear, m[9 + r]);
+            out_normal[r] = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(m[r], nx), _mm_mul_ps(m[3 + r], ny)),
+                _mm_mul_ps(m[6 + r], nz)
+                );
+        }
+        __m128 length_sq = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(out_normal[0], out_normal[0]), _mm_mul_ps(out_normal[1], out_normal[1])),
+            _mm_mul_ps(out_normal[2], out_normal[2])
+            );
+        __m128 length = _mm_sqrt_ps(_mm_max_ps(length_sq, _mm_set1_ps(1e-20f)));
+        _mm_storeu_ps(&skinned.position_x[i], out[0]);
+        _mm_storeu_ps(&skinned.position_y[i], out[1]);
+        _mm_storeu_ps(&skinned.position_z[i], out[2]);
+        _mm_storeu_ps(&skinned.normal_x[i], _mm_div_ps(out_normal[0], length));
+        _mm_storeu_ps(&skinned.normal_y[i], _mm_div_ps(out_normal[1], length));
+        _mm_storeu_ps(&skinned.normal_z[i], _mm_div_ps(out_normal[2], length));
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void skin_avx2(
+        SkinnedVertices& skinned,
+        const SkinningStream& stream,
+        const float* palette,
+        size_t begin,
+        size_t end
+        )
+{
+    for (size_t i = begin; i < end; i += 8) {
+        __m256 m[N_AFFINE_ELEMENTS];
+        for (size_t e = 0; e < N_AFFINE_ELEMENTS; e++) {
+            m[e] = _mm256_setzero_ps();
+        }
+        for (size_t k = 0; k < 4; k++) {
+            __m256i ids = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&stream.bone_ids[k][i]));
+            __m256i bone_offsets = _mm256_slli_epi32(ids, 4);
+            __m256 weight = _mm256_loadu_ps(&stream.bone_weights[k][i]);
+            for (size_t e = 0; e < N_AFFINE_ELEMENTS; e++) {
+                __m256 element = _mm256_i32gather_ps(palette + affine_offset(e), bone_offsets, 4);
+                m[e] = _mm256_fmadd_ps(weight, element, m[e]);
+            }
+        }
+        __m256 x = _mm256_loadu_ps(&stream.position_x[i]);
+        __m256 y = _mm256_loadu_ps(&stream.position_y[i]);
+        __m256 z = _mm256_loadu_ps(&stream.position_z[i]);
+        __m256 nx = _mm256_loadu_ps(&stream.normal_x[i]);
+        __m256 ny = _mm256_loadu_ps(&stream.normal_y[i]);
+        __m256 nz = _mm256_loadu_ps(&stream.normal_z[i]);
+        __m256 out[3];
+        __m256 out_normal[3];
+        for (size_t r = 0; r < 3; r++) {
+            out[r] = _mm256_fmadd_ps(m[r], x, _mm256_fmadd_ps(m[3 + r], y, _mm256_fmadd_ps(m[6 + r], z, m[9 + r])));
+            out_normal[r] = _mm256_fmadd_ps(m[r], nx, _mm256_fmadd_ps(m[3 + r], ny, _mm256_mul_ps(m[6 + r], nz)));
+        }
+        __m256 length_sq = _mm256_fmadd_ps(
+            out_normal[0], out_normal[0],
+            _mm256_fmadd_ps(out_normal[1], out_normal[1], _mm256_mul_ps(out_normal[2], out_normal[2]))
+            );
+        __m256 length = _mm256_sqrt_ps(_mm256_max_ps(length_sq, _mm256_set1_ps(1e-20f)));
+        _mm256_storeu_ps(&skinned.position_x[i], out[0]);
+        _mm256_storeu_ps(&skinned.position_y[i], out[1]);
+        _mm256_storeu_ps(&skinned.position_z[i], out[2]);
+        _mm256_storeu_ps(&skinned.normal_x[i], _mm256_div_ps(out_normal[0], length));
+        _mm256_storeu_ps(&skinned.normal_y[i], _mm256_div_ps(out_normal[1], length));
+        _mm256_storeu_ps(&skinned.normal_z[i], _mm256_div_ps(out_normal[2], length));
+    }
+}
+#endif
+
+bool Skinner::init()
+{
+    kernel_ = Kernel::SCALAR;
+#if defined(SKINNING_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") and __builtin_cpu_supports("fma")) {
+        kernel_ = Kernel::AVX2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        kernel_ = Kernel::SSE2;
+    }
+#endif
+    return true;
+}
+
+void Skinner::make_stream(SkinningStream& stream, const Model* model)
+{
+    const std::vector<VertPNUBiBw>& vertices = model->vertices;
+    stream.n_vertices = vertices.size();
+    stream.n_padded = (
+        (vertices.size() + SKINNING_BLOCK_SIZE - 1) / SKINNING_BLOCK_SIZE * SKINNING_BLOCK_SIZE
+        );
+    stream.position_x.assign(stream.n_padded, 0.f);
+    stream.position_y.assign(stream.n_padded, 0.f);
+    stream.position_z.assign(stream.n_padded, 0.f);
+    stream.normal_x.assign(stream.n_padded, 0.f);
+    stream.normal_y.assign(stream.n_padded, 0.f);
+    stream.normal_z.assign(stream.n_padded, 0.f);
+    for (size_t k = 0; k < 4; k++) {
+        stream.bone_ids[k].assign(stream.n_padded, 0);
+        stream.bone_weights[k].assign(stream.n_padded, 0.f);
+    }
+    for (size_t i = 0; i < vertices.size(); i++) {
+        const VertPNUBiBw& vert = vertices[i];
+        stream.position_x[i] = vert.position.x;
+        stream.position_y[i] = vert.position.y;
+        stream.position_z[i] = vert.position.z;
+        stream.normal_x[i] = vert.normal.x;
+        stream.normal_y[i] = vert.normal.y;
+        stream.normal_z[i] = vert.normal.z;
+        for (size_t k = 0; k < 4; k++) {
+            stream.bone_ids[k][i] = vert.bone_ids[k];
+            stream.bone_weights[k][i] = vert.bone_weights[k];
+        }
+    }
+}
+
+void Skinner::skin(SkinnedVertices& skinned, const SkinningStream& stream, ConstPoseView palette)
+{
+    const size_t MIN_RANGE_BLOCKS = 1024;
+    auto start_time = std::chrono::steady_clock::now();
+
+    skinned.n_vertices = stream.n_vertices;
+    skinned.position_x.resize(stream.n_padded);
+    skinned.position_y.resize(stream.n_padded);
+    skinned.position_z.resize(stream.n_padded);
+    skinned.normal_x.resize(stream.n_padded);
+    skinned.normal_y.resize(stream.n_padded);
+    skinned.normal_z.resize(stream.n_padded);
+
+    const float* palette_data = glm::value_ptr(palette[0]);
+    size_t n_blocks = stream.n_padded / SKINNING_BLOCK_SIZE;
+    Kernel kernel = kernel_;
+    parallel_for_ranges(n_blocks, MIN_RANGE_BLOCKS, [&](size_t, size_t begin, size_t end) {
+        begin *= SKINNING_BLOCK_SIZE;
+        end *= SKINNING_BLOCK_SIZE;
+        switch (kernel) {
+#if defined(SKINNING_X86)
+        case Kernel::AVX2: skin_avx2(skinned, stream, palette_data, begin, end); break;
+        case Kernel::SSE2: skin_sse2(skinned, stream, palette_data, begin, end); break;
+#endif
+        default: skin_scalar(skinned, stream, palette_data, begin, end); break;
+        }
+    });
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+    switch (kernel_) {
+    case Kernel::AVX2: stats_.kernel = "avx2"; break;
+    case Kernel::SSE2: stats_.kernel = "sse2"; break;
+    default: stats_.kernel = "scalar"; break;
+    }
+    stats_.n_vertices = stream.n_vertices;
+    stats_.n_threads = parallel_range_count(n_blocks, MIN_RANGE_BLOCKS);
+    stats_.seconds = elapsed.count();
+}
+
+const SkinningStats& Skinner::get_stats() const
+{
+    return stats_;
+}
+
+void Skinner::print_stats() const
+{
+    double per_core = 0.0;
+    if (stats_.seconds > 0.0 and stats_.n_threads > 0) {
+        per_core = stats_.n_vertices / stats_.seconds / stats_.n_threads;
+    }
+    printf(
+        "Skinned %zu vertices in %.3f ms with %s on %zu threads (%.2f M vertices/s/core).\n",
+        stats_.n_vertices, stats_.seconds * 1000.0, stats_.kernel, stats_.n_threads, per_core / 1e6
+        );
+}
@@ -0,0 +1,88 @@
+#include "vat.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+static const char VAT_MAGIC[4] = {'V', 'A', 'T', '1'};
+
+struct VatHeader
+{
+    char magic[4];
+    uint32_t n_vertices;
+    uint32_t n_frames;
+    float duration;
+    float bounds_min[3];
+    float bounds_max[3];
+};
+
+bool write_vertex_animation(const VertexAnimation* vat, const char* path)
+{
+    FILE* file = fopen(path, "wb");
+    if (file == nullptr) {
+        fprintf(stderr, "Failed to open \"%s\" for writing.\n", path);
+        return false;
+    }
+    VatHeader header;
+    std::memcpy(header.magic, VAT_MAGIC, sizeof(VAT_MAGIC));
+    header.n_vertices = vat->n_vertices;
+    header.n_frames = vat->n_frames;
+    header.duration = vat->duration;
+    for (size_t i = 0; i < 3; i++) {
+        header.bounds_min[i] = vat->bounds.min[i];
+        header.bounds_max[i] = vat->bounds.max[i];
+    }
+    bool ok = (
+        fwrite(&header, sizeof(header), 1, file) == 1 and
+        fwrite(vat->positions.data(), sizeof(uint16_t), vat->positions.size(), file) == vat->positions.size() and
+        fwrite(vat->normals.data(), sizeof(int8_t), vat->normals.size(), file) == vat->normals.size()
+        );
+    fclose(file);
+    if (not ok) {
+        fprintf(stderr, "Failed to write \"%s\".\n", path);
+    }
+    return ok;
+}
+
+bool read_vertex_animation(VertexAnimation* vat, const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) {
+        fprintf(stderr, "Failed to open \"%s\".\n", path);
+        return false;
+    }
+    long file_size = fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1;
+    VatHeader header;
+    bool ok = (
+        file_size >= 0 and
+        fseek(file, 0, SEEK_SET) == 0 and
+        fread(&header, sizeof(header), 1, file) == 1 and
+        std::memcmp(header.magic, VAT_MAGIC, sizeof(VAT_MAGIC)) == 0
+        );
+    // Each texel holds four positions and four normals; check the header
+    // against what the file holds before sizing the streams from it.
+    size_t n_stream_bytes = static_cast<size_t>(std::max<long>(0, file_size - static_cast<long>(sizeof(header))));
+    size_t max_texels = n_stream_bytes / (4 * (sizeof(uint16_t) + sizeof(int8_t)));
+    ok = ok and (header.n_frames == 0 or header.n_vertices <= max_texels / header.n_frames);
+    if (ok) {
+        vat->n_vertices = header.n_vertices;
+        vat->n_frames = header.n_frames;
+        vat->duration = header.duration;
+        for (size_t i = 0; i < 3; i++) {
+            vat->bounds.min[i] = header.bounds_min[i];
+            vat->bounds.max[i] = header.bounds_max[i];
+        }
+        size_t n_texels = vat->n_vertices * vat->n_frames;
+        vat->positions.resize(4 * n_texels);
+        vat->normals.resize(4 * n_texels);
+        ok = (
+            fread(vat->positions.data(), sizeof(uint16_t), vat->positions.size(), file) == vat->positions.size() and
+            fread(vat->normals.data(), sizeof(int8_t), vat->normals.size(), file) == vat->normals.size()
+            );
+    }
+    fclose(file);
+    if (not ok) {
+        fprintf(stderr, "Failed to read vertex animation \"%s\".\n", path);
+    }
+    return ok;
+}
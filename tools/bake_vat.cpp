@@ -0,0 +1,44 @@
+#include "model.hpp"
+#include "skinning.hpp"
+#include "vat.hpp"
+#include <cstdio>
+#include <cstdlib>
+
+int main(int argc, char** argv)
+{
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <model> <output.vat> [frame rate] [import profile]\n", argv[0]);
+        return -1;
+    }
+    const char* model_path = argv[1];
+    const char* output_path = argv[2];
+    float frame_rate = argc > 3 ? static_cast<float>(atof(argv[3])) : 30.f;
+    ImportProfile profile = ImportProfile::PRODUCTION;
+    if (argc > 4 and not find_import_profile(profile, argv[4])) {
+        return -1;
+    }
+
+    // Baking skins on the CPU, so the import needs no GL context.
+    ModelManager mm {nullptr, nullptr, nullptr};
+    Skinner skinner;
+    skinner.init();
+
+    Model model;
+    Animation animation;
+    if (not mm.import_model(&model, &animation, model_path, profile)) {
+        return -1;
+    }
+    if (animation.n_channels == 0) {
+        fprintf(stderr, "Model \"%s\" has no animation.\n", model_path);
+        return -1;
+    }
+
+    VertexAnimation vat;
+    mm.bake_vertex_animation(&vat, &skinner, &model, &animation, frame_rate);
+    skinner.print_stats();
+    if (not write_vertex_animation(&vat, output_path)) {
+        return -1;
+    }
+    printf("Wrote \"%s\".\n", output_path);
+    return 0;
+}
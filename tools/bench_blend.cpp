@@ -0,0 +1,199 @@
+#include "arena.hpp"
+#include "blend.hpp"
+#include "model.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+#include <assimp/scene.h>
+#include <glm/gtc/quaternion.hpp>
+
+static const size_t N_LIMBS = 8;
+
+static aiNode* make_node(const std::string& name, aiNode* parent, size_t n_children)
+{
+    aiNode* node = new aiNode;
+    node->mName = aiString(name);
+    node->mParent = parent;
+    node->mChildren = n_children > 0 ? new aiNode*[n_children] : nullptr;
+    return node;
+}
+
+// A root bone with N_LIMBS chains of `limb_length` bones hanging off it,
+// skinned by a single mesh that references every bone.
+static aiScene* make_limb_scene(size_t limb_length)
+{
+    aiScene* scene = new aiScene;
+    aiNode* root = make_node("root", nullptr, 2);
+    scene->mRootNode = root;
+
+    aiNode* body = make_node("body", root, 0);
+    body->mNumMeshes = 1;
+    body->mMeshes = new unsigned int[1] {0};
+    root->mChildren[root->mNumChildren++] = body;
+
+    size_t n_bones = 1 + N_LIMBS * limb_length;
+    aiMesh* mesh = new aiMesh;
+    mesh->mBones = new aiBone*[n_bones];
+    scene->mNumMeshes = 1;
+    scene->mMeshes = new aiMesh*[1] {mesh};
+
+    aiNode* hips = make_node("hips", root, N_LIMBS);
+    root->mChildren[root->mNumChildren++] = hips;
+    mesh->mBones[mesh->mNumBones] = new aiBone;
+    mesh->mBones[mesh->mNumBones++]->mName = aiString(std::string{"hips"});
+    for (size_t i = 0; i < N_LIMBS; i++) {
+        aiNode* parent = hips;
+        for (size_t j = 0; j < limb_length; j++) {
+            std::string name = "limb_" + std::to_string(i) + "_" + std::to_string(j);
+            aiNode* bone_node = make_node(name, parent, 1);
+            // One unit along the parent's y, bent by a radian about z.
+            bone_node->mTransformation.a1 = std::cos(1.f);
+            bone_node->mTransformation.a2 = -std::sin(1.f);
+            bone_node->mTransformation.b1 = std::sin(1.f);
+            bone_node->mTransformation.b2 = std::cos(1.f);
+            bone_node->mTransformation.b4 = 1.f;
+            parent->mChildren[parent->mNumChildren++] = bone_node;
+            mesh->mBones[mesh->mNumBones] = new aiBone;
+            mesh->mBones[mesh->mNumBones++]->mName = aiString(name);
+            parent = bone_node;
+        }
+    }
+    return scene;
+}
+
+// Every bone swings up to 2.5 radians either way about z, and bobs and
+// stretches along y, over `n_keys` keys of each kind.
+static void make_swing_animation(Animation* animation, const Model* model, size_t n_keys)
+{
+    animation->duration = static_cast<float>(n_keys - 1);
+    animation->n_channels = model->n_bones - 1;
+    for (size_t i = 1; i < model->n_bones; i++) {
+        Channel& channel = animation->channels[i - 1];
+        channel.bone_id = static_cast<uint8_t>(i);
+        for (size_t k = 0; k < n_keys; k++) {
+            float time = static_cast<float>(k);
+            float phase = std::sin(0.3f * time + 0.1f * i);
+            glm::vec3 stretch {0.f, 0.1f * phase, 0.f};
+            channel.rotation_keys.push_back({time, glm::angleAxis(2.5f * phase, glm::vec3{0.f, 0.f, 1.f})});
+            channel.position_keys.push_back({time, model->default_pose.positions[i] + stretch});
+            channel.scale_keys.push_back({time, model->default_pose.scales[i] + stretch});
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t limb_length = argc > 1 ? static_cast<size_t>(atoi(argv[1])) : 12;
+    size_t n_iterations = argc > 2 ? static_cast<size_t>(atoi(argv[2])) : 10000;
+    // Bone 0 is the dummy root, bone 1 the hips.
+    if (2 + N_LIMBS * limb_length > MAX_BONES) {
+        fprintf(stderr, "Failed to build a skeleton of %zu limbs of %zu bones\n", N_LIMBS, limb_length);
+        return -1;
+    }
+
+    ModelManager mm {nullptr, nullptr, nullptr};
+    std::unique_ptr<aiScene> scene {make_limb_scene(limb_length)};
+    std::unique_ptr<Model> model {new Model};
+    if (not mm.build_skeleton(model.get(), scene.get())) {
+        return -1;
+    }
+    // build_skeleton leaves out skeleton LODs; a single level keeps every bone.
+    model->n_skeleton_lods = 1;
+    model->skeleton_lod_bones[0].reset();
+    for (size_t i = 0; i < model->n_bones; i++) {
+        model->skeleton_lod_bones[0].set(i);
+        model->skeleton_lod_remap[0][i] = static_cast<uint8_t>(i);
+    }
+    std::unique_ptr<Animation> animation {new Animation};
+    make_swing_animation(animation.get(), model.get(), 64);
+
+    // One layer per limb, each masked to its limb, as when upper and lower
+    // body, arms and so on play separate clips.
+    std::vector<BoneMask> masks (N_LIMBS);
+    BlendLayer layers[N_LIMBS];
+    for (size_t i = 0; i < N_LIMBS; i++) {
+        if (not make_bone_mask(masks[i], model.get(), "limb_" + std::to_string(i) + "_0")) {
+            return -1;
+        }
+        layers[i].animation = animation.get();
+        layers[i].time = 0.1f * i;
+        layers[i].mask = &masks[i];
+    }
+
+    // The baseline samples every channel for every layer and lets the masks
+    // zero out the weights afterwards.
+    LocalPose full_pose;
+    LocalPose masked_pose;
+    LocalPose layer_pose;
+    PoseAccumulator acc;
+    double full_ms = 0.0;
+    double masked_ms = 0.0;
+    float max_error = 0.f;
+    size_t n_allocations = get_heap_counts().n_allocations;
+    for (size_t i = 0; i < n_iterations; i++) {
+        for (size_t j = 0; j < N_LIMBS; j++) {
+            layers[j].time = 0.1f * j + 0.01f * i;
+        }
+        auto start_time = std::chrono::steady_clock::now();
+        clear_pose_accumulator(acc, model->n_bones);
+        for (const BlendLayer& layer : layers) {
+            mm.update_pose(model.get(), layer_pose, layer.animation, layer.time);
+            accumulate_pose(acc, layer_pose, layer.weight, layer.mask, model->n_bones);
+        }
+        resolve_pose(full_pose, acc, model->default_pose, model->n_bones);
+        auto mid_time = std::chrono::steady_clock::now();
+        mm.blend_pose(model.get(), masked_pose, layers, N_LIMBS);
+        auto end_time = std::chrono::steady_clock::now();
+        full_ms += std::chrono::duration<double, std::milli>(mid_time - start_time).count();
+        masked_ms += std::chrono::duration<double, std::milli>(end_time - mid_time).count();
+        for (size_t j = 0; j < model->n_bones; j++) {
+            max_error = std::max(max_error, 1.f - std::abs(glm::dot(full_pose.rotations[j], masked_pose.rotations[j])));
+        }
+    }
+    n_allocations = get_heap_counts().n_allocations - n_allocations;
+
+    // make_additive stores the clip as deltas from the rest pose, so adding
+    // it at full weight to the rest pose has to give back the source clip.
+    std::unique_ptr<Animation> additive {new Animation(*animation)};
+    if (not mm.make_additive(additive.get(), model.get())) {
+        return -1;
+    }
+    float max_position_error = 0.f;
+    float max_rotation_error = 0.f;
+    float max_scale_error = 0.f;
+    for (size_t i = 0; i < 1000; i++) {
+        float time = 0.0037f * i;
+        mm.update_pose(model.get(), full_pose, animation.get(), time);
+        LocalPose& additive_pose = masked_pose;
+        additive_pose = model->default_pose;
+        mm.apply_additive(model.get(), additive_pose, additive.get(), time, 1.f);
+        for (size_t j = 0; j < model->n_bones; j++) {
+            glm::vec3 position_error = glm::abs(full_pose.positions[j] - additive_pose.positions[j]);
+            glm::vec3 scale_error = glm::abs(full_pose.scales[j] - additive_pose.scales[j]);
+            float rotation_error = 1.f - std::abs(glm::dot(full_pose.rotations[j], additive_pose.rotations[j]));
+            max_position_error = std::max(max_position_error, std::max(position_error.x, std::max(position_error.y, position_error.z)));
+            max_scale_error = std::max(max_scale_error, std::max(scale_error.x, std::max(scale_error.y, scale_error.z)));
+            max_rotation_error = std::max(max_rotation_error, rotation_error);
+        }
+    }
+
+    printf(
+        "%zu bones, %zu masked layers: %.4f ms sampling every bone, %.4f ms sampling masked bones.\n",
+        model->n_bones, N_LIMBS, full_ms / n_iterations, masked_ms / n_iterations
+        );
+    printf("Largest rotation difference %g, %zu heap allocations.\n", max_error, n_allocations);
+    printf(
+        "Additive round trip: largest position error %g, rotation error %g, scale error %g.\n",
+        max_position_error, max_rotation_error, max_scale_error
+        );
+    if (max_position_error > 1e-4f or max_rotation_error > 1e-4f or max_scale_error > 1e-4f) {
+        fprintf(stderr, "Failed to reproduce the source clip from its additive version\n");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,62 @@
+#include "model.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s [--profile <import profile>] <model>...\n", argv[0]);
+        return -1;
+    }
+    ImportProfile profile = ImportProfile::PRODUCTION;
+    int first_path = 1;
+    if (strcmp(argv[1], "--profile") == 0) {
+        if (argc < 4 or not find_import_profile(profile, argv[2])) {
+            return -1;
+        }
+        first_path = 3;
+    }
+    std::vector<const char*> paths (argv + first_path, argv + argc);
+
+    ModelManager mm {nullptr, nullptr, nullptr};
+    std::vector<std::unique_ptr<Model>> models;
+    std::vector<std::unique_ptr<Animation>> animations;
+    for (size_t i = 0; i < paths.size(); i++) {
+        models.emplace_back(new Model);
+        animations.emplace_back(new Animation);
+    }
+
+    // The baseline imports one model after the other, each using every
+    // hardware thread for its vertex passes.
+    auto start_time = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < paths.size(); i++) {
+        if (not mm.import_model(models[i].get(), animations[i].get(), paths[i], profile)) {
+            return -1;
+        }
+    }
+    std::chrono::duration<double, std::milli> serial_elapsed = std::chrono::steady_clock::now() - start_time;
+
+    std::vector<Model*> model_ptrs;
+    std::vector<Animation*> animation_ptrs;
+    for (size_t i = 0; i < paths.size(); i++) {
+        models[i].reset(new Model);
+        animations[i].reset(new Animation);
+        model_ptrs.push_back(models[i].get());
+        animation_ptrs.push_back(animations[i].get());
+    }
+    start_time = std::chrono::steady_clock::now();
+    if (not mm.import_models(model_ptrs.data(), animation_ptrs.data(), paths.data(), paths.size(), profile)) {
+        return -1;
+    }
+    std::chrono::duration<double, std::milli> parallel_elapsed = std::chrono::steady_clock::now() - start_time;
+
+    printf(
+        "%zu models on up to %zu importers: %.3f ms one at a time, %.3f ms concurrently (%.2fx).\n",
+        paths.size(), mm.get_max_concurrent_imports(), serial_elapsed.count(), parallel_elapsed.count(),
+        serial_elapsed.count() / parallel_elapsed.count()
+        );
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include "model.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+#include <assimp/scene.h>
+
+static aiNode* make_node(const std::string& name, aiNode* parent, size_t n_children)
+{
+    aiNode* node = new aiNode;
+    node->mName = aiString(name);
+    node->mParent = parent;
+    node->mChildren = n_children > 0 ? new aiNode*[n_children] : nullptr;
+    return node;
+}
+
+// A chain of `depth` bones under an armature node, each with
+// `n_helpers` non-bone children (IK targets, sockets and the like), skinned
+// by a single mesh that references every bone.
+static aiScene* make_deep_scene(size_t depth, size_t n_helpers)
+{
+    aiScene* scene = new aiScene;
+    aiNode* root = make_node("root", nullptr, 2);
+    scene->mRootNode = root;
+
+    aiNode* body = make_node("body", root, 0);
+    body->mNumMeshes = 1;
+    body->mMeshes = new unsigned int[1] {0};
+    root->mChildren[root->mNumChildren++] = body;
+
+    aiMesh* mesh = new aiMesh;
+    mesh->mNumBones = depth;
+    mesh->mBones = new aiBone*[depth];
+    scene->mNumMeshes = 1;
+    scene->mMeshes = new aiMesh*[1] {mesh};
+
+    aiNode* parent = make_node("armature", root, 1);
+    root->mChildren[root->mNumChildren++] = parent;
+    for (size_t i = 0; i < depth; i++) {
+        std::string name = "bone_" + std::to_string(i);
+        aiNode* bone_node = make_node(name, parent, n_helpers + 1);
+        bone_node->mTransformation.b4 = 1.f;
+        parent->mChildren[parent->mNumChildren++] = bone_node;
+        for (size_t j = 0; j < n_helpers; j++) {
+            aiNode* helper = make_node(name + "_helper_" + std::to_string(j), bone_node, 0);
+            bone_node->mChildren[bone_node->mNumChildren++] = helper;
+        }
+        aiBone* bone = new aiBone;
+        bone->mName = aiString(name);
+        mesh->mBones[i] = bone;
+        parent = bone_node;
+    }
+    return scene;
+}
+
+int main(int argc, char** argv)
+{
+    size_t n_helpers = argc > 1 ? static_cast<size_t>(atoi(argv[1])) : 8;
+    size_t n_iterations = argc > 2 ? static_cast<size_t>(atoi(argv[2])) : 10;
+    const size_t depths[] = {10, 30, 60, 90};
+
+    // build_skeleton touches no GL state and prints nothing, so the timings
+    // cover the hierarchy flattening alone.
+    ModelManager mm {nullptr, nullptr, nullptr};
+    std::vector<std::string> results;
+    for (size_t depth : depths) {
+        std::unique_ptr<aiScene> scene {make_deep_scene(depth, n_helpers)};
+        double total_ms = 0.0;
+        for (size_t i = 0; i < n_iterations; i++) {
+            std::unique_ptr<Model> model {new Model};
+            auto start_time = std::chrono::steady_clock::now();
+            if (not mm.build_skeleton(model.get(), scene.get())) {
+                return -1;
+            }
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start_time;
+            total_ms += elapsed.count();
+        }
+        char line[128];
+        snprintf(
+            line, sizeof(line), "Depth %zu, %zu helpers per bone: %.3f ms per skeleton.",
+            depth, n_helpers, total_ms / n_iterations
+            );
+        results.push_back(line);
+    }
+    for (const std::string& line : results) {
+        printf("%s\n", line.c_str());
+    }
+    return 0;
+}
@@ -0,0 +1,308 @@
+#include "image.hpp"
+#include "mapped_io.hpp"
+#include "model.hpp"
+#include "model_cache.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+
+static const char* const MODEL_EXTENSIONS[] = {".fbx", ".dae", ".gltf", ".glb", ".obj", ".3ds", ".blend"};
+// Part of every asset's hash record; bump it whenever the cache formats or
+// the import pipeline change so that existing caches get rebuilt.
+static const char* const CACHE_VERSION = "2";
+
+enum class AssetStatus
+{
+    CONVERTED,
+    UP_TO_DATE,
+    FAILED,
+};
+
+struct AssetResult
+{
+    AssetStatus status = AssetStatus::FAILED;
+    double elapsed_ms = 0.0;
+    size_t n_output_bytes = 0;
+};
+
+static bool has_model_extension(const char* name)
+{
+    size_t length = strlen(name);
+    for (const char* extension : MODEL_EXTENSIONS) {
+        size_t extension_length = strlen(extension);
+        if (length <= extension_length) continue;
+        const char* suffix = name + length - extension_length;
+        bool is_match = true;
+        for (size_t i = 0; i < extension_length and is_match; i++) {
+            is_match = tolower(static_cast<unsigned char>(suffix[i])) == extension[i];
+        }
+        if (is_match) return true;
+    }
+    return false;
+}
+
+// Appends the paths of all model files under `root`/`relative_dir`, relative
+// to `root`. Symbolic links to directories are not followed.
+static void find_models(std::vector<std::string>& paths, const std::string& root, const std::string& relative_dir)
+{
+    std::string dir_path = relative_dir.empty() ? root : root + "/" + relative_dir;
+    DIR* dir = opendir(dir_path.c_str());
+    if (dir == nullptr) {
+        fprintf(stderr, "Failed to open directory \"%s\".\n", dir_path.c_str());
+        return;
+    }
+    while (dirent* entry = readdir(dir)) {
+        if (strcmp(entry->d_name, ".") == 0 or strcmp(entry->d_name, "..") == 0) continue;
+        std::string relative_path = relative_dir.empty() ? entry->d_name : relative_dir + "/" + entry->d_name;
+        std::string path = root + "/" + relative_path;
+        struct stat info;
+        if (lstat(path.c_str(), &info) != 0) continue;
+        if (S_ISDIR(info.st_mode)) {
+            find_models(paths, root, relative_path);
+        } else if (has_model_extension(entry->d_name)) {
+            paths.push_back(relative_path);
+        }
+    }
+    closedir(dir);
+}
+
+static bool is_file(const std::string& path)
+{
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 and S_ISREG(info.st_mode);
+}
+
+static size_t get_file_size(const std::string& path)
+{
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 ? static_cast<size_t>(info.st_size) : 0;
+}
+
+static bool make_directories(const std::string& path)
+{
+    for (size_t i = 1; i <= path.size(); i++) {
+        if (i < path.size() and path[i] != '/') continue;
+        std::string prefix = path.substr(0, i);
+        if (mkdir(prefix.c_str(), 0755) != 0 and errno != EEXIST) {
+            fprintf(stderr, "Failed to create directory \"%s\".\n", prefix.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool hash_file(uint64_t& hash, const std::string& path)
+{
+    MappedFile file;
+    if (not file.open(path.c_str())) {
+        return false;
+    }
+    // 64-bit FNV-1a.
+    hash = 14695981039346656037ull;
+    const char* data = file.get_data();
+    for (size_t i = 0; i < file.get_size(); i++) {
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * 1099511628211ull;
+    }
+    return true;
+}
+
+// A record is a version line followed by one line per file the conversion
+// read or looked for: the source model, the side files its importer opened
+// and the textures its materials name. Files that were found are listed as
+// "<hash> <path>" and missing ones as "absent <path>". The cache is up to
+// date if every listed file still hashes to its recorded value and every
+// absent one is still missing.
+static bool is_up_to_date(const std::string& record_path, const char* profile_name)
+{
+    FILE* file = fopen(record_path.c_str(), "r");
+    if (file == nullptr) {
+        return false;
+    }
+    char line[4096];
+    std::string version_line = std::string{"version "} + CACHE_VERSION + " " + profile_name + "\n";
+    bool is_current = fgets(line, sizeof(line), file) != nullptr and version_line == line;
+    while (is_current and fgets(line, sizeof(line), file) != nullptr) {
+        char* path = strchr(line, ' ');
+        if (path == nullptr) {
+            is_current = false;
+            break;
+        }
+        path[strcspn(path, "\n")] = '\0';
+        if (strncmp(line, "absent ", 7) == 0) {
+            is_current = not is_file(path + 1);
+            continue;
+        }
+        uint64_t hash = 0;
+        is_current = hash_file(hash, path + 1) and strtoull(line, nullptr, 16) == hash;
+    }
+    fclose(file);
+    return is_current;
+}
+
+static bool write_record(const std::string& record_path, const char* profile_name, const std::vector<std::string>& inputs)
+{
+    FILE* file = fopen(record_path.c_str(), "w");
+    if (file == nullptr) {
+        fprintf(stderr, "Failed to open \"%s\" for writing.\n", record_path.c_str());
+        return false;
+    }
+    bool ok = fprintf(file, "version %s %s\n", CACHE_VERSION, profile_name) > 0;
+    for (const std::string& input : inputs) {
+        uint64_t hash = 0;
+        if (not is_file(input)) {
+            ok = ok and fprintf(file, "absent %s\n", input.c_str()) > 0;
+        } else {
+            ok = ok and hash_file(hash, input) and fprintf(file, "%016" PRIx64 " %s\n", hash, input.c_str()) > 0;
+        }
+    }
+    ok = fclose(file) == 0 and ok;
+    if (not ok) {
+        fprintf(stderr, "Failed to write \"%s\".\n", record_path.c_str());
+    }
+    return ok;
+}
+
+static AssetResult convert_asset(
+        ModelManager& mm,
+        ImageLoader& il,
+        std::mutex& il_mutex,
+        const std::string& input_path,
+        const std::string& output_base,
+        ImportProfile profile,
+        size_t max_import_threads
+        )
+{
+    auto start_time = std::chrono::steady_clock::now();
+    AssetResult result;
+    const char* profile_name = get_import_settings(profile).name;
+    std::string record_path = output_base + ".hash";
+    if (is_up_to_date(record_path, profile_name)) {
+        result.status = AssetStatus::UP_TO_DATE;
+    } else if (make_directories(output_base.substr(0, output_base.find_last_of('/')))) {
+        std::unique_ptr<Model> model {new Model};
+        std::unique_ptr<Animation> animation {new Animation};
+        std::vector<std::string> inputs;
+        std::vector<std::string> outputs;
+        bool ok = mm.import_model(
+            model.get(), animation.get(), input_path.c_str(), profile, max_import_threads, &inputs
+            );
+        for (size_t i = 0; i < model->n_materials and ok; i++) {
+            Material& mat = model->materials[i];
+            // Materials without a texture name get the model's directory.
+            // A named texture that shows up later makes the record out of
+            // date.
+            bool has_texture_name = not mat.diffuse_path.empty() and mat.diffuse_path.back() != '/';
+            if (has_texture_name and std::find(inputs.begin(), inputs.end(), mat.diffuse_path) == inputs.end()) {
+                inputs.push_back(mat.diffuse_path);
+            }
+            if (not is_file(mat.diffuse_path)) {
+                mat.diffuse_path.clear();
+                continue;
+            }
+            std::vector<uint8_t> pixels;
+            size_t width = 0, height = 0;
+            {
+                // DevIL keeps its state in globals.
+                std::lock_guard<std::mutex> lock {il_mutex};
+                ok = il.load_image_pixels(pixels, width, height, mat.diffuse_path.c_str());
+            }
+            std::string texture_path = output_base + "." + std::to_string(i) + ".tex";
+            ok = ok and write_texture_cache(pixels, width, height, texture_path.c_str());
+            outputs.push_back(texture_path);
+            // Cached materials refer to their texture relative to the model.
+            mat.diffuse_path = texture_path.substr(texture_path.find_last_of('/') + 1);
+        }
+        std::string model_path = output_base + ".model";
+        ok = ok and write_model_cache(model.get(), model_path.c_str());
+        outputs.push_back(model_path);
+        if (ok and animation->n_channels > 0) {
+            std::string animation_path = output_base + ".clip";
+            ok = write_animation_cache(animation.get(), animation_path.c_str());
+            outputs.push_back(animation_path);
+        }
+        // The record goes last, so an interrupted conversion is redone.
+        ok = ok and write_record(record_path, profile_name, inputs);
+        if (ok) {
+            result.status = AssetStatus::CONVERTED;
+            for (const std::string& output : outputs) {
+                result.n_output_bytes += get_file_size(output);
+            }
+        }
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start_time;
+    result.elapsed_ms = elapsed.count();
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <input dir> <output dir> [import profile] [threads]\n", argv[0]);
+        return -1;
+    }
+    std::string input_dir = argv[1];
+    std::string output_dir = argv[2];
+    ImportProfile profile = ImportProfile::PRODUCTION;
+    if (argc > 3 and not find_import_profile(profile, argv[3])) {
+        return -1;
+    }
+    size_t n_threads = argc > 4 ? static_cast<size_t>(atoi(argv[4])) : SIZE_MAX;
+
+    // Importing, decoding and writing caches need no GL context.
+    ImageLoader il;
+    if (not il.init()) {
+        fprintf(stderr, "Failed to initialize image loader.\n");
+        return -1;
+    }
+    ModelManager mm {nullptr, &il, nullptr};
+
+    auto start_time = std::chrono::steady_clock::now();
+    std::vector<std::string> paths;
+    find_models(paths, input_dir, "");
+    std::sort(paths.begin(), paths.end());
+
+    std::vector<AssetResult> results (paths.size());
+    std::mutex il_mutex;
+    // Workers beyond the importer pool would only wait for an importer.
+    n_threads = std::min(n_threads, mm.get_max_concurrent_imports());
+    n_threads = parallel_for_each(paths.size(), n_threads, [&](size_t i, size_t max_import_threads) {
+        results[i] = convert_asset(
+            mm, il, il_mutex, input_dir + "/" + paths[i], output_dir + "/" + paths[i], profile, max_import_threads
+            );
+    });
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start_time;
+
+    size_t n_converted = 0, n_up_to_date = 0, n_failed = 0, n_output_bytes = 0;
+    printf("%-10s %10s %12s  %s\n", "status", "time (ms)", "output (KiB)", "asset");
+    for (size_t i = 0; i < paths.size(); i++) {
+        const AssetResult& result = results[i];
+        const char* status = "failed";
+        switch (result.status) {
+        case AssetStatus::CONVERTED: status = "converted"; n_converted++; break;
+        case AssetStatus::UP_TO_DATE: status = "up to date"; n_up_to_date++; break;
+        case AssetStatus::FAILED: n_failed++; break;
+        }
+        n_output_bytes += result.n_output_bytes;
+        printf(
+            "%-10s %10.1f %12.1f  %s\n",
+            status, result.elapsed_ms, result.n_output_bytes / 1024.0, paths[i].c_str()
+            );
+    }
+    printf(
+        "Converted %zu, skipped %zu up to date and failed %zu of %zu assets on %zu threads in %.3f ms, writing %.1f KiB.\n",
+        n_converted, n_up_to_date, n_failed, paths.size(), n_threads, elapsed.count(), n_output_bytes / 1024.0
+        );
+    return n_failed > 0 ? -1 : 0;
+}
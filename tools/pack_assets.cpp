@@ -0,0 +1,18 @@
+#include "mapped_io.hpp"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+int main(int argc, char** argv)
+{
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <output.pack> <file>...\n", argv[0]);
+        return -1;
+    }
+    std::vector<std::string> paths (argv + 2, argv + argc);
+    if (not write_asset_pack(argv[1], paths)) {
+        return -1;
+    }
+    printf("Packed %zu files into \"%s\".\n", paths.size(), argv[1]);
+    return 0;
+}